@@ -0,0 +1,525 @@
+// Throughput and latency benchmarks for every interpreter variant in the repository.
+// Each variant is compiled into its own namespace, fed the same workload corpora and measured for
+// parse / evaluate time, end-to-end time per expression, p50 / p99 latency, heap allocations per
+// expression and peak resident memory. Every (variant, corpus) pair runs in a forked child so
+// peak RSS is its own and a crashing engine cannot take the suite down.
+//
+// Usage: benchmark_suite [--calls=N] [--variant=a,b] [--corpus=a,b] [--json=FILE]
+//                        [--baseline=FILE] [--tolerance=0.25]
+// With --baseline, results are compared to an earlier --json file and the exit status is 1 when any
+// end-to-end time got slower by more than the tolerance.
+
+// Everything the variants include, pulled in here first so the includes inside the namespaces are no-ops
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <sstream>
+#include <stack>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "binary_log.h"
+#include "epoch.h"
+#include "fast_trig.h"
+
+// Heap allocations made by the code under test
+static std::atomic<uint64_t> allocationCount{0};
+
+void* operator new(std::size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+// Out of line so GCC does not pair the free() with an inlined operator new and warn about a mismatch
+[[gnu::noinline]] void operator delete(void* memory) noexcept { std::free(memory); }
+[[gnu::noinline]] void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+
+#define main variant_main
+namespace final_submission {
+#include "final_submission"
+}
+namespace kyapata {
+#include "kyapata.cpp"
+}
+namespace hopefully {
+#include "hopefully.cpp"
+}
+namespace letstry {
+#include "letstry.cpp"
+}
+namespace maybe {
+#include "maybe.cpp"
+}
+namespace trig {
+#include "trig.cpp"
+}
+#undef main
+
+// Common face of the variants
+class Engine {
+public:
+    virtual ~Engine() = default;
+    virtual void define(const std::string& name, double value) = 0;
+    // Parses and evaluates input the way the variant's REPL does, without console I/O; false on an error
+    virtual bool run(const std::string& input, double& value) = 0;
+    // Variants with a separate parse step expose it, so parsing and evaluation can be timed apart
+    virtual bool hasPhases() const { return false; }
+    virtual void parse(const std::string&) {}
+    virtual void prepare(const std::vector<std::string>&) {} // Parses every input once for eval()
+    virtual double eval(size_t) { return 0; }
+};
+
+// Variants that print their result return it as text
+bool parseResult(const std::string& text, double& value) {
+    if (text.empty() || text.compare(0, 6, "Error:") == 0) return false;
+    value = std::strtod(text.c_str(), nullptr);
+    return true;
+}
+
+class FinalEngine : public Engine {
+    final_submission::Context context;
+    final_submission::Interpreter interpreter{&context};
+    final_submission::ExpressionCompiler compiler{&context};
+    std::vector<final_submission::CompiledExpression> programs;
+    std::string out;
+
+public:
+    void define(const std::string& name, double value) override { context.set(name, value); }
+    bool run(const std::string& input, double& value) override {
+        out.clear();
+        return interpreter.interpret(input, out, value) == final_submission::Interpreter::Outcome::Value;
+    }
+    bool hasPhases() const override { return true; }
+    void parse(const std::string& input) override { compiler.compile(input); }
+    void prepare(const std::vector<std::string>& corpus) override {
+        for (const std::string& input : corpus) programs.push_back(compiler.compile(input));
+    }
+    double eval(size_t index) override { return programs[index].eval(context); }
+};
+
+class KyapataEngine : public Engine {
+    kyapata::Context context;
+    kyapata::Interpreter interpreter{&context};
+    kyapata::ExpressionArena arena;
+    std::vector<kyapata::Token> tokens;
+    std::vector<std::unique_ptr<kyapata::ExpressionArena>> arenas; // Own the prepared trees
+    std::vector<kyapata::FlatExpression> programs;
+
+public:
+    void define(const std::string& name, double value) override { context.variables[name] = value; }
+    bool run(const std::string& input, double& value) override {
+        try {
+            value = interpreter.interpret(input);
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+    bool hasPhases() const override { return true; }
+    void parse(const std::string& input) override {
+        interpreter.tokenize(input, tokens);
+        interpreter.buildExpressionTree(tokens, arena);
+        arena.reset();
+    }
+    void prepare(const std::vector<std::string>& corpus) override {
+        for (const std::string& input : corpus) {
+            arenas.push_back(std::make_unique<kyapata::ExpressionArena>());
+            interpreter.tokenize(input, tokens);
+            kyapata::Expression* tree = interpreter.buildExpressionTree(tokens, *arenas.back());
+            programs.emplace_back(kyapata::ExpressionOptimizer(*arenas.back()).optimize(tree));
+        }
+    }
+    double eval(size_t index) override { return programs[index].interpret(context); }
+};
+
+class HopefullyEngine : public Engine {
+    hopefully::Context context;
+    hopefully::Interpreter interpreter{&context};
+
+public:
+    void define(const std::string& name, double value) override { context.variables[name] = value; }
+    bool run(const std::string& input, double& value) override {
+        try {
+            value = interpreter.interpret(input);
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+};
+
+class LetstryEngine : public Engine {
+    letstry::Context context;
+    letstry::Interpreter interpreter{&context};
+
+public:
+    void define(const std::string& name, double value) override { context.variables[name] = value; }
+    bool run(const std::string& input, double& value) override { return parseResult(interpreter.interpret(input), value); }
+};
+
+class MaybeEngine : public Engine {
+public:
+    void define(const std::string&, double) override {}
+    bool run(const std::string& input, double& value) override {
+        maybe::Context context; // The REPL starts from a fresh context for every input
+        maybe::Interpreter interpreter(&context);
+        try {
+            value = interpreter.interpret(input);
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+};
+
+class TrigEngine : public Engine {
+    trig::Context context;
+    trig::Interpreter interpreter{&context}; // Appends to calculations.log like the REPL does
+
+public:
+    void define(const std::string& name, double value) override { context.variables[name] = value; }
+    bool run(const std::string& input, double& value) override { return parseResult(interpreter.interpret(input), value); }
+};
+
+// Workloads. Variables are single letters and calls are not nested so the older variants can take part.
+struct Corpus {
+    std::string name;
+    std::vector<std::pair<std::string, double>> variables;
+    std::vector<std::string> inputs;
+};
+
+std::vector<Corpus> makeCorpora() {
+    std::mt19937 random(2024);
+    auto pick = [&](int low, int high) { return std::uniform_int_distribution<int>(low, high)(random); };
+    auto number = [&] {
+        return pick(0, 1) ? std::to_string(pick(1, 99)) : std::to_string(pick(1, 99)) + "." + std::to_string(pick(1, 9));
+    };
+    const char operators[] = "+-*/";
+    std::vector<Corpus> corpora(5);
+
+    corpora[0].name = "short"; // 2 to 5 numeric operands
+    for (int i = 0; i < 1000; i++) {
+        std::string text = number();
+        for (int k = pick(1, 4); k > 0; k--) text += std::string(pick(0, 1) ? " " : "") + operators[pick(0, 3)] + number();
+        corpora[0].inputs.push_back(text);
+    }
+
+    corpora[1].name = "deep"; // 32 levels of parentheses
+    for (int i = 0; i < 200; i++) {
+        std::string text = number();
+        for (int depth = 0; depth < 32; depth++) text = "(" + text + operators[pick(0, 2)] + number() + ")";
+        corpora[1].inputs.push_back(text);
+    }
+
+    corpora[2].name = "variables"; // 6 to 12 operands, mostly variables
+    const std::string names = "xyzrw";
+    for (char name : names) corpora[2].variables.push_back({std::string(1, name), pick(1, 50) / 4.0});
+    for (int i = 0; i < 1000; i++) {
+        auto operand = [&] { return pick(0, 3) ? std::string(1, names[pick(0, 4)]) : number(); };
+        std::string text = operand();
+        for (int k = pick(5, 11); k > 0; k--) text += operators[pick(0, 3)] + operand();
+        corpora[2].inputs.push_back(text);
+    }
+
+    corpora[3].name = "functions"; // add/sub/mul/div/mod with 2 to 6 arguments
+    const char* functions[] = {"add", "sub", "mul", "div", "mod"};
+    for (int i = 0; i < 1000; i++) {
+        std::string text = std::string(functions[pick(0, 4)]) + "(" + number();
+        for (int k = pick(1, 5); k > 0; k--) text += "," + number();
+        corpora[3].inputs.push_back(text + ")");
+    }
+
+    corpora[4].name = "trig"; // sin/cos/tan of an angle in degrees
+    const char* trig[] = {"sin", "cos", "tan"};
+    for (int i = 0; i < 1000; i++) corpora[4].inputs.push_back(std::string(trig[pick(0, 2)]) + "(" + std::to_string(pick(0, 89)) + ")");
+    return corpora;
+}
+
+struct Variant {
+    std::string name;
+    std::vector<std::string> corpora; // Workloads the variant's grammar understands
+    std::function<std::unique_ptr<Engine>()> create;
+};
+
+std::vector<Variant> makeVariants() {
+    return {
+        {"final_submission", {"short", "deep", "variables", "functions", "trig"}, [] { return std::unique_ptr<Engine>(new FinalEngine); }},
+        {"kyapata", {"short", "deep", "variables"}, [] { return std::unique_ptr<Engine>(new KyapataEngine); }},
+        {"hopefully", {"short", "deep", "variables"}, [] { return std::unique_ptr<Engine>(new HopefullyEngine); }},
+        {"letstry", {"short", "deep", "variables", "functions"}, [] { return std::unique_ptr<Engine>(new LetstryEngine); }},
+        {"maybe", {"short", "deep"}, [] { return std::unique_ptr<Engine>(new MaybeEngine); }},
+        {"trig", {"short", "deep", "variables", "functions", "trig"}, [] { return std::unique_ptr<Engine>(new TrigEngine); }},
+    };
+}
+
+struct Measurement {
+    size_t calls = 0, errors = 0;
+    double parse_ns = -1, eval_ns = -1; // -1 when the variant has no separate phases
+    double total_ns = 0, p50_ns = 0, p99_ns = 0, allocations = 0, checksum = 0;
+};
+
+double nanosSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Cost of reading the clock twice, subtracted from single-call latencies
+double timerOverhead() {
+    std::vector<double> samples(10000);
+    for (double& sample : samples) {
+        auto start = std::chrono::steady_clock::now();
+        sample = nanosSince(start);
+    }
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return samples[samples.size() / 2];
+}
+
+Measurement measure(const Variant& variant, const Corpus& corpus, size_t calls) {
+    Measurement m;
+    std::unique_ptr<Engine> engine = variant.create();
+    for (const auto& variable : corpus.variables) engine->define(variable.first, variable.second);
+    const std::vector<std::string>& inputs = corpus.inputs;
+    double value;
+    for (const std::string& input : inputs) { // Warm up and check results
+        if (engine->run(input, value)) m.checksum += value;
+        else m.errors++;
+    }
+
+    uint64_t before = allocationCount.load(std::memory_order_relaxed);
+    for (const std::string& input : inputs) engine->run(input, value);
+    m.allocations = double(allocationCount.load(std::memory_order_relaxed) - before) / inputs.size();
+
+    size_t passes = std::max<size_t>(1, calls / inputs.size());
+    m.calls = passes * inputs.size();
+    std::vector<double> latencies;
+    latencies.reserve(m.calls);
+    double overhead = timerOverhead();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t pass = 0; pass < passes; pass++) {
+        for (const std::string& input : inputs) {
+            auto begin = std::chrono::steady_clock::now();
+            engine->run(input, value);
+            latencies.push_back(std::max(0.0, nanosSince(begin) - overhead));
+        }
+    }
+    m.total_ns = (nanosSince(start) - overhead * m.calls) / m.calls;
+    std::sort(latencies.begin(), latencies.end());
+    m.p50_ns = latencies[latencies.size() / 2];
+    m.p99_ns = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+
+    if (engine->hasPhases()) {
+        start = std::chrono::steady_clock::now();
+        for (size_t pass = 0; pass < passes; pass++) {
+            for (const std::string& input : inputs) engine->parse(input);
+        }
+        m.parse_ns = nanosSince(start) / m.calls;
+        engine->prepare(inputs);
+        volatile double sink = 0;
+        start = std::chrono::steady_clock::now();
+        for (size_t pass = 0; pass < passes; pass++) {
+            for (size_t i = 0; i < inputs.size(); i++) {
+                try {
+                    sink = engine->eval(i);
+                } catch (const std::exception&) {
+                }
+            }
+        }
+        m.eval_ns = nanosSince(start) / m.calls;
+        (void)sink;
+    }
+    return m;
+}
+
+std::string jsonNumber(double value) {
+    if (!std::isfinite(value)) return "null";
+    char buffer[64];
+    return std::string(buffer, std::to_chars(buffer, buffer + sizeof buffer, value, std::chars_format::fixed, 2).ptr);
+}
+
+// One result object on a single line (the baseline reader relies on that)
+std::string toJson(const std::string& variant, const std::string& corpus, const std::string& status,
+                   const Measurement* m, long peakRssKb) {
+    std::string json = "{\"variant\": \"" + variant + "\", \"corpus\": \"" + corpus + "\", \"status\": \"" + status + "\"";
+    if (m) {
+        json += ", \"calls\": " + std::to_string(m->calls) + ", \"errors\": " + std::to_string(m->errors);
+        json += ", \"parse_ns\": " + (m->parse_ns < 0 ? std::string("null") : jsonNumber(m->parse_ns));
+        json += ", \"eval_ns\": " + (m->eval_ns < 0 ? std::string("null") : jsonNumber(m->eval_ns));
+        json += ", \"total_ns\": " + jsonNumber(m->total_ns) + ", \"p50_ns\": " + jsonNumber(m->p50_ns);
+        json += ", \"p99_ns\": " + jsonNumber(m->p99_ns) + ", \"allocations_per_expression\": " + jsonNumber(m->allocations);
+        char checksum[64]; // Shortest form: deep corpora produce very large sums
+        json += ", \"checksum\": " + (std::isfinite(m->checksum) ? std::string(checksum, std::to_chars(checksum, checksum + 64, m->checksum).ptr) : "null");
+    }
+    if (peakRssKb >= 0) json += ", \"peak_rss_kb\": " + std::to_string(peakRssKb);
+    return json + "}";
+}
+
+// Value of "key": in a one-line result object, as text without quotes
+std::string field(const std::string& line, const std::string& key) {
+    size_t at = line.find("\"" + key + "\": ");
+    if (at == std::string::npos) return "";
+    at += key.size() + 4;
+    if (line[at] == '"') return line.substr(at + 1, line.find('"', at + 1) - at - 1);
+    return line.substr(at, line.find_first_of(",}", at) - at);
+}
+
+std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) items.push_back(item);
+    return items;
+}
+
+// Runs one measurement in a child process; returns its JSON object
+std::string runIsolated(const Variant& variant, const Corpus& corpus, size_t calls, const std::string& scratch) {
+    int channel[2];
+    if (pipe(channel) != 0) return toJson(variant.name, corpus.name, "error: pipe failed", nullptr, -1);
+    std::cout.flush();
+    pid_t child = fork();
+    if (child == 0) {
+        close(channel[0]);
+        if (chdir(scratch.c_str()) != 0) _exit(2); // Files the variants write land in the scratch directory
+        Measurement m = measure(variant, corpus, calls);
+        std::string json = toJson(variant.name, corpus.name, "ok", &m, -1);
+        ssize_t written = write(channel[1], json.data(), json.size());
+        _exit(written == ssize_t(json.size()) ? 0 : 3);
+    }
+    close(channel[1]);
+    std::string json;
+    char buffer[4096];
+    for (ssize_t n; (n = read(channel[0], buffer, sizeof buffer)) > 0;) json.append(buffer, size_t(n));
+    close(channel[0]);
+    int status = 0;
+    struct rusage usage {};
+    wait4(child, &status, 0, &usage);
+    if (WIFSIGNALED(status)) return toJson(variant.name, corpus.name, "crashed: signal " + std::to_string(WTERMSIG(status)), nullptr, usage.ru_maxrss);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || json.empty()) {
+        return toJson(variant.name, corpus.name, "failed", nullptr, usage.ru_maxrss);
+    }
+    json.pop_back(); // Reopen the object to add the child's peak RSS
+    return json + ", \"peak_rss_kb\": " + std::to_string(usage.ru_maxrss) + "}";
+}
+
+int main(int argc, char* argv[]) {
+    size_t calls = 50000;
+    std::vector<std::string> onlyVariants, onlyCorpora;
+    std::string jsonPath, baselinePath;
+    double tolerance = 0.25;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&](const char* prefix) { return arg.compare(0, std::strlen(prefix), prefix) == 0 ? arg.substr(std::strlen(prefix)) : std::string(); };
+        if (!value("--calls=").empty()) calls = std::stoul(value("--calls="));
+        else if (!value("--variant=").empty()) onlyVariants = splitList(value("--variant="));
+        else if (!value("--corpus=").empty()) onlyCorpora = splitList(value("--corpus="));
+        else if (!value("--json=").empty()) jsonPath = value("--json=");
+        else if (!value("--baseline=").empty()) baselinePath = value("--baseline=");
+        else if (!value("--tolerance=").empty()) tolerance = std::stod(value("--tolerance="));
+        else {
+            std::cerr << "Unknown option " << arg << "\n";
+            return 2;
+        }
+    }
+    auto selected = [](const std::vector<std::string>& only, const std::string& name) {
+        return only.empty() || std::find(only.begin(), only.end(), name) != only.end();
+    };
+
+    char scratch[] = "/tmp/interpreter-bench-XXXXXX";
+    if (!mkdtemp(scratch)) {
+        std::cerr << "Cannot create a scratch directory\n";
+        return 1;
+    }
+
+    std::vector<Corpus> corpora = makeCorpora();
+    std::vector<std::string> results;
+    std::cout << std::left << std::setw(18) << "variant" << std::setw(11) << "corpus" << std::right << std::setw(10) << "parse ns"
+              << std::setw(10) << "eval ns" << std::setw(10) << "total ns" << std::setw(10) << "p50 ns" << std::setw(10) << "p99 ns"
+              << std::setw(9) << "allocs" << std::setw(10) << "RSS KB" << std::setw(8) << "errors" << "\n";
+    for (const Variant& variant : makeVariants()) {
+        if (!selected(onlyVariants, variant.name)) continue;
+        for (const Corpus& corpus : corpora) {
+            if (!selected(onlyCorpora, corpus.name)) continue;
+            bool supported = std::find(variant.corpora.begin(), variant.corpora.end(), corpus.name) != variant.corpora.end();
+            std::string json = supported ? runIsolated(variant, corpus, calls, scratch) : toJson(variant.name, corpus.name, "unsupported", nullptr, -1);
+            results.push_back(json);
+            std::cout << std::left << std::setw(18) << variant.name << std::setw(11) << corpus.name << std::right;
+            if (field(json, "status") != "ok") {
+                std::cout << "  " << field(json, "status") << "\n";
+                continue;
+            }
+            for (const char* key : {"parse_ns", "eval_ns", "total_ns", "p50_ns", "p99_ns"}) {
+                std::string text = field(json, key);
+                std::cout << std::setw(10) << (text == "null" ? "-" : text.substr(0, text.find('.')));
+            }
+            std::cout << std::setw(9) << field(json, "allocations_per_expression") << std::setw(10) << field(json, "peak_rss_kb")
+                      << std::setw(8) << field(json, "errors") << "\n";
+        }
+    }
+    std::string logPath = std::string(scratch) + "/calculations.log";
+    std::remove(logPath.c_str());
+    rmdir(scratch);
+
+    if (!jsonPath.empty()) {
+        std::ofstream out(jsonPath);
+        out << "{\"suite\": \"interpreter-benchmarks\", \"version\": 1, \"calls\": " << calls << ", \"results\": [\n";
+        for (size_t i = 0; i < results.size(); i++) out << "  " << results[i] << (i + 1 < results.size() ? ",\n" : "\n");
+        out << "]}\n";
+    }
+
+    int status = 0;
+    if (!baselinePath.empty()) {
+        std::ifstream baseline(baselinePath);
+        if (!baseline) {
+            std::cerr << "Cannot open baseline " << baselinePath << "\n";
+            return 1;
+        }
+        std::map<std::pair<std::string, std::string>, double> before;
+        for (std::string line; std::getline(baseline, line);) {
+            std::string total = field(line, "total_ns");
+            if (!total.empty() && total != "null") before[{field(line, "variant"), field(line, "corpus")}] = std::stod(total);
+        }
+        for (const std::string& json : results) {
+            auto it = before.find({field(json, "variant"), field(json, "corpus")});
+            std::string total = field(json, "total_ns");
+            if (it == before.end() || total.empty() || total == "null") continue;
+            double now = std::stod(total);
+            if (now > it->second * (1 + tolerance)) {
+                std::cout << "REGRESSION " << it->first.first << "/" << it->first.second << ": " << it->second << " -> " << now << " ns\n";
+                status = 1;
+            }
+        }
+    }
+    return status;
+}
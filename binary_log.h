@@ -0,0 +1,361 @@
+// Compact binary history/audit log and the background thread that writes it.
+//
+// File layout: "CLOG", a version byte and a style byte (which text log the records stand for),
+// then records back to back. Every record is
+//     tag (1 byte) | time since the previous record in microseconds (zigzag varint) | payload
+// with the payload depending on the tag:
+//     Value   input length (varint), input bytes, result as a little-endian IEEE double
+//     Empty   input length, input bytes                       (assignment, nothing printed)
+//     Error   input length, input bytes, message length, message bytes
+//     Text    input length, input bytes, result length, result bytes (already formatted result)
+//     Dropped number of records lost to the Drop overflow policy (varint)
+//     Session nothing; every open of the file writes one, timed from zero rather than from the
+//             record before it, so appended sessions restart the clock at an absolute time
+// log_decoder.cpp turns a log back into the text the programs used to write.
+#ifndef BINARY_LOG_H
+#define BINARY_LOG_H
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#if defined(__unix__)
+#include <unistd.h> // fdatasync
+#endif
+
+namespace binlog {
+
+constexpr char Magic[4] = {'C', 'L', 'O', 'G'};
+constexpr uint8_t Version = 2; // 2 added Session records
+
+enum class Style : uint8_t { History = 0, Calculation = 1 }; // history_final.txt / calculation_log.txt
+enum class Tag : uint8_t { Value = 0, Empty = 1, Error = 2, Text = 3, Dropped = 4, Session = 5 };
+
+struct Record {
+    Tag tag = Tag::Empty;
+    int64_t micros = 0;  // Wall-clock time the record was logged
+    double value = 0;    // Value records
+    uint64_t count = 0;  // Dropped records
+    std::string input;
+    std::string text;    // Error message or formatted result
+};
+
+inline void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+inline bool getVarint(const char*& p, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t byte = uint8_t(*p++);
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+inline void putString(std::string& out, std::string_view text) {
+    putVarint(out, text.size());
+    out.append(text.data(), text.size());
+}
+
+inline bool getString(const char*& p, const char* end, std::string& text) {
+    uint64_t length;
+    if (!getVarint(p, end, length) || length > uint64_t(end - p)) return false;
+    text.assign(p, size_t(length));
+    p += length;
+    return true;
+}
+
+inline std::string header(Style style) {
+    return std::string(Magic, 4) + char(Version) + char(style);
+}
+
+// Reads the file header, false if data is not a log this version understands
+inline bool readHeader(const char*& p, const char* end, Style& style) {
+    if (end - p < 6 || std::memcmp(p, Magic, 4) != 0 || uint8_t(p[4]) < 1 || uint8_t(p[4]) > Version || uint8_t(p[5]) > 1) return false;
+    style = Style(p[5]);
+    p += 6;
+    return true;
+}
+
+// Appends one record; previousMicros carries the timestamp of the record before it
+inline void encode(std::string& out, const Record& record, int64_t& previousMicros) {
+    out.push_back(char(record.tag));
+    if (record.tag == Tag::Session) previousMicros = 0;
+    int64_t delta = record.micros - previousMicros;
+    putVarint(out, (uint64_t(delta) << 1) ^ uint64_t(delta >> 63)); // Zigzag, producers may log slightly out of order
+    previousMicros = record.micros;
+    if (record.tag == Tag::Session) return;
+    if (record.tag == Tag::Dropped) {
+        putVarint(out, record.count);
+        return;
+    }
+    putString(out, record.input);
+    if (record.tag == Tag::Value) {
+        uint64_t bits;
+        std::memcpy(&bits, &record.value, sizeof bits);
+        for (int i = 0; i < 8; i++) out.push_back(char(bits >> (8 * i)));
+    } else if (record.tag == Tag::Error || record.tag == Tag::Text) {
+        putString(out, record.text);
+    }
+}
+
+// Reads the record at p, false at the end of data or on a truncated/corrupt record
+inline bool decode(const char*& p, const char* end, Record& record, int64_t& previousMicros) {
+    if (p >= end || uint8_t(*p) > uint8_t(Tag::Session)) return false;
+    record.tag = Tag(*p++);
+    if (record.tag == Tag::Session) previousMicros = 0;
+    uint64_t zigzag;
+    if (!getVarint(p, end, zigzag)) return false;
+    record.micros = previousMicros + int64_t((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+    previousMicros = record.micros;
+    if (record.tag == Tag::Session) return true;
+    if (record.tag == Tag::Dropped) return getVarint(p, end, record.count);
+    if (!getString(p, end, record.input)) return false;
+    if (record.tag == Tag::Value) {
+        if (end - p < 8) return false;
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; i++) bits |= uint64_t(uint8_t(p[i])) << (8 * i);
+        std::memcpy(&record.value, &bits, sizeof bits);
+        p += 8;
+        return true;
+    }
+    if (record.tag == Tag::Error || record.tag == Tag::Text) return getString(p, end, record.text);
+    return true;
+}
+
+// What a producer does when the ring is full
+enum class Overflow {
+    Block, // Wait for the writer thread to make room: no record is lost
+    Drop   // Discard the record and count it; the log gets a Dropped record so the gap is visible
+};
+
+struct Options {
+    size_t capacity = 4096;                      // Records the ring holds, rounded up to a power of two
+    size_t batchSize = 256;                      // Records gathered before one write to the file
+    std::chrono::milliseconds flushInterval{50}; // Longest a record waits before it is written
+    Overflow overflow = Overflow::Block;
+    bool sync = false;                           // fdatasync after every batch (durable, but disk-bound)
+};
+
+// Applies a command-line setting (--log-batch=N, --log-flush-ms=N, --log-capacity=N,
+// --log-overflow=block|drop, --log-sync) to options; false if arg is not one of them
+inline bool parseOption(const std::string& arg, Options& options) {
+    auto number = [&](const char* prefix, size_t& out) {
+        size_t length = std::strlen(prefix);
+        if (arg.compare(0, length, prefix) != 0) return false;
+        const char* end = arg.data() + arg.size();
+        auto parsed = std::from_chars(arg.data() + length, end, out);
+        return parsed.ec == std::errc() && parsed.ptr == end;
+    };
+    size_t value;
+    if (number("--log-batch=", options.batchSize)) return true;
+    if (number("--log-capacity=", options.capacity)) return true;
+    if (number("--log-flush-ms=", value)) {
+        options.flushInterval = std::chrono::milliseconds(value);
+        return true;
+    }
+    if (arg == "--log-overflow=block" || arg == "--log-overflow=drop") {
+        options.overflow = arg.back() == 'k' ? Overflow::Block : Overflow::Drop;
+        return true;
+    }
+    if (arg == "--log-sync") {
+        options.sync = true;
+        return true;
+    }
+    return false;
+}
+
+// Log file written by a background thread. Producers hand records over through a bounded lock-free
+// multi-producer/single-consumer ring (one sequence number per cell) and return immediately;
+// the writer thread encodes them and writes whole batches.
+class AsyncWriter {
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Record record; // Strings keep their capacity, so a warm ring logs without allocating
+    };
+
+    Options options;
+    std::FILE* file = nullptr;
+    std::unique_ptr<Cell[]> cells;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> enqueuePosition{0};
+    alignas(64) std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> stopping{false};
+    int64_t sessionMicros = 0; // Time of this open's Session record, which the next record is timed from
+    std::thread writer;
+
+    static int64_t nowMicros() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Claims a cell, lets fill write the record and publishes it; false when the ring is full
+    template <typename Fill>
+    bool tryPush(Fill& fill) {
+        size_t position = enqueuePosition.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t difference = intptr_t(sequence) - intptr_t(position);
+            if (difference == 0) {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    fill(cell.record);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false; // The writer has not freed this cell yet
+            } else {
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    template <typename Fill>
+    void push(Fill fill) {
+        if (!file) return;
+        while (!tryPush(fill)) {
+            if (options.overflow == Overflow::Drop) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    void run() {
+        std::string buffer;
+        int64_t previousMicros = sessionMicros;
+        size_t readPosition = 0, pending = 0;
+        auto firstPending = std::chrono::steady_clock::now();
+        auto idleSleep = std::chrono::microseconds(50);
+        while (true) {
+            bool stop = stopping.load(std::memory_order_acquire); // Read before draining so nothing pushed earlier is missed
+            size_t taken = 0;
+            while (taken < options.batchSize) {
+                Cell& cell = cells[readPosition & mask];
+                if (cell.sequence.load(std::memory_order_acquire) != readPosition + 1) break;
+                if (pending == 0) firstPending = std::chrono::steady_clock::now();
+                encode(buffer, cell.record, previousMicros);
+                cell.sequence.store(readPosition + mask + 1, std::memory_order_release); // Hand the cell back to producers
+                readPosition++;
+                taken++;
+                pending++;
+            }
+            if (uint64_t lost = dropped.exchange(0, std::memory_order_relaxed)) {
+                Record record;
+                record.tag = Tag::Dropped;
+                record.micros = nowMicros();
+                record.count = lost;
+                if (pending == 0) firstPending = std::chrono::steady_clock::now();
+                encode(buffer, record, previousMicros);
+                pending++;
+            }
+            bool due = pending >= options.batchSize || stop ||
+                       std::chrono::steady_clock::now() - firstPending >= options.flushInterval;
+            if (pending && due) {
+                write(buffer);
+                pending = 0;
+            }
+            if (stop && taken == 0) break;
+            if (taken == 0) {
+                // Nothing to do: back off, but never beyond the flush interval
+                std::this_thread::sleep_for(std::min<std::chrono::microseconds>(idleSleep, options.flushInterval));
+                idleSleep = std::min(idleSleep * 2, std::chrono::microseconds(2000));
+            } else {
+                idleSleep = std::chrono::microseconds(50);
+            }
+        }
+        write(buffer);
+    }
+
+    void write(std::string& buffer) {
+        if (buffer.empty()) return;
+        std::fwrite(buffer.data(), 1, buffer.size(), file);
+        std::fflush(file);
+#if defined(__unix__)
+        if (options.sync) fdatasync(fileno(file));
+#endif
+        buffer.clear();
+    }
+
+public:
+    AsyncWriter(const std::string& path, Style style, Options options = Options()) : options(options) {
+        size_t capacity = 1;
+        while (capacity < options.capacity) capacity <<= 1;
+        if (this->options.batchSize == 0) this->options.batchSize = 1;
+        mask = capacity - 1;
+        cells.reset(new Cell[capacity]);
+        for (size_t i = 0; i < capacity; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+        file = std::fopen(path.c_str(), "ab");
+        if (!file) return; // Logging is best effort, evaluation goes on without it
+        std::fseek(file, 0, SEEK_END);
+        std::string start = std::ftell(file) == 0 ? header(style) : std::string();
+        Record session;
+        session.tag = Tag::Session;
+        session.micros = nowMicros();
+        encode(start, session, sessionMicros);
+        std::fwrite(start.data(), 1, start.size(), file);
+        writer = std::thread([this] { run(); });
+    }
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    // Writes everything still queued and closes the file
+    ~AsyncWriter() {
+        stopping.store(true, std::memory_order_release);
+        if (writer.joinable()) writer.join();
+        if (file) std::fclose(file);
+    }
+
+    bool isOpen() const { return file != nullptr; }
+
+    void value(std::string_view input, double result) {
+        int64_t micros = nowMicros();
+        push([&](Record& record) {
+            record.tag = Tag::Value;
+            record.micros = micros;
+            record.input.assign(input.data(), input.size());
+            record.value = result;
+        });
+    }
+
+    void empty(std::string_view input) {
+        int64_t micros = nowMicros();
+        push([&](Record& record) {
+            record.tag = Tag::Empty;
+            record.micros = micros;
+            record.input.assign(input.data(), input.size());
+        });
+    }
+
+    void error(std::string_view input, std::string_view message) { withText(Tag::Error, input, message); }
+    void text(std::string_view input, std::string_view result) { withText(Tag::Text, input, result); }
+
+private:
+    void withText(Tag tag, std::string_view input, std::string_view text) {
+        int64_t micros = nowMicros();
+        push([&](Record& record) {
+            record.tag = tag;
+            record.micros = micros;
+            record.input.assign(input.data(), input.size());
+            record.text.assign(text.data(), text.size());
+        });
+    }
+};
+
+} // namespace binlog
+
+#endif
@@ -0,0 +1,136 @@
+// Read-copy-update for state many threads read and one writer at a time replaces.
+//
+// The current version sits behind one atomic pointer. A reader pins it by writing the global epoch
+// into its own slot, then loads the pointer; it never takes a lock, waits or writes shared memory
+// other than its slot. A writer builds the next version off to the side and swaps it in with one
+// atomic exchange, so readers see the old version or the new one, never a mix. The old version is
+// retired with the epoch it was replaced in and freed on a later publish, once every pinned reader
+// entered after that epoch: no reader can still be looking at it.
+//
+// Writers must be serialized by the caller. Readers (and their Guards) must not outlive the Versioned.
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace epoch {
+
+template <typename T>
+class Versioned {
+private:
+    struct Slot {
+        std::atomic<uint64_t> pinned{0}; // Epoch the reader entered in, 0 while it is not reading
+        bool used = false;               // Owned by a live Reader, guarded by slotsLock
+    };
+
+    std::atomic<const T*> current;
+    std::atomic<uint64_t> clock{1};
+    std::mutex slotsLock; // Registering readers and the writer's scan; never taken on the read path
+    std::deque<Slot> slots; // A deque so slots keep their address as readers come and go
+    std::vector<std::pair<const T*, uint64_t>> retired; // Replaced versions and the epoch they were replaced in
+    uint64_t published = 0;
+
+    Slot* acquireSlot() {
+        std::lock_guard<std::mutex> guard(slotsLock);
+        for (Slot& slot : slots) {
+            if (!slot.used) {
+                slot.used = true;
+                return &slot;
+            }
+        }
+        slots.emplace_back();
+        slots.back().used = true;
+        return &slots.back();
+    }
+
+    void releaseSlot(Slot* slot) {
+        std::lock_guard<std::mutex> guard(slotsLock);
+        slot->used = false;
+    }
+
+    // Frees the retired versions no pinned reader can hold
+    void reclaim() {
+        uint64_t oldest = UINT64_MAX;
+        {
+            std::lock_guard<std::mutex> guard(slotsLock);
+            for (const Slot& slot : slots) {
+                uint64_t pinned = slot.pinned.load();
+                if (pinned != 0 && pinned < oldest) oldest = pinned;
+            }
+        }
+        size_t kept = 0;
+        for (auto& entry : retired) {
+            if (entry.second < oldest) delete entry.first;
+            else retired[kept++] = entry;
+        }
+        retired.resize(kept);
+    }
+
+public:
+    // Pins the version that was current when it was made, for as long as it lives
+    class Guard {
+    private:
+        std::atomic<uint64_t>* pinned;
+        const T* version;
+
+    public:
+        Guard(std::atomic<uint64_t>* pinned, const T* version) : pinned(pinned), version(version) {}
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+        ~Guard() { pinned->store(0, std::memory_order_release); }
+
+        const T& operator*() const { return *version; }
+        const T* operator->() const { return version; }
+    };
+
+    // One per reading thread. A reader holds at most one Guard at a time.
+    class Reader {
+    private:
+        Versioned* owner;
+        Slot* slot;
+
+    public:
+        explicit Reader(Versioned& owner) : owner(&owner), slot(owner.acquireSlot()) {}
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+        ~Reader() { owner->releaseSlot(slot); }
+
+        // The current version, safe to read until the guard goes away. Wait-free.
+        Guard read() {
+            slot->pinned.store(owner->clock.load()); // Sequentially consistent: ordered before the load below
+            return Guard(&slot->pinned, owner->current.load());
+        }
+    };
+
+    explicit Versioned(std::unique_ptr<const T> initial) : current(initial.release()) {}
+    Versioned(const Versioned&) = delete;
+    Versioned& operator=(const Versioned&) = delete;
+    ~Versioned() {
+        delete current.load();
+        for (auto& entry : retired) delete entry.first;
+    }
+
+    // Makes next the version every later read() returns and frees what readers have let go of
+    void publish(std::unique_ptr<const T> next) {
+        const T* old = current.exchange(next.release());
+        retired.emplace_back(old, clock.fetch_add(1));
+        published++;
+        reclaim();
+    }
+
+    // The version the writer published last; only for the writer, which never sees it change under it
+    const T& latest() const { return *current.load(std::memory_order_relaxed); }
+
+    uint64_t versions() const { return published; } // Publishes so far
+    size_t pending() const { return retired.size(); } // Retired versions still waiting for readers
+};
+
+} // namespace epoch
+
+#endif
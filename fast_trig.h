@@ -0,0 +1,199 @@
+// Degree-based sine, cosine and tangent for loops over many angles.
+//
+// Libm converts every angle to radians (x * pi / 180) and calls std::sin / std::cos / std::tan,
+// which is what the calculators have always done. The two fast modes reduce the angle in degrees
+// instead, where the reduction is exact (x - 360k, then x - 90q leaves r in [-45, 45] with no
+// rounding), and only then convert the small remainder to radians:
+//     Polynomial  minimax polynomials for sin and cos on [-pi/4, pi/4] (the fdlibm kernels)
+//     Table       sin and cos of whole degrees from a 46-entry table, combined with short Taylor
+//                 polynomials for the remaining fraction of a degree (|b| <= 0.5 degrees)
+// Exact reduction means multiples of 90 degrees give exact results (sin(180) is 0, not 1.2e-16).
+//
+// Max error against a long double reference, 4M random angles in [-1e6, 1e6] degrees:
+//     Polynomial  sin 1.6 ulp, cos 1.6 ulp, tan 3.3 ulp
+//     Table       sin 2.5 ulp, cos 2.5 ulp, tan 4.6 ulp
+// Libm has no ulp bound near the zeros, because x * pi / 180 is rounded before the reduction.
+// trig.cpp --bench measures both again, along with the throughput of each mode.
+//
+// Angles beyond +-2^44 degrees are reduced with std::fmod, which is exact but slower. Infinities
+// and NaN give NaN, as libm does.
+// The array form is a branch-free loop per function and mode; the compiler vectorizes the
+// polynomial loops at -O3 (add -march=native for AVX2 / AVX-512). The table loops need gather
+// loads and stay scalar where the target's tuning avoids them.
+#ifndef FAST_TRIG_H
+#define FAST_TRIG_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace fasttrig {
+
+enum class Mode : uint8_t { Libm, Polynomial, Table };
+enum class Function : uint8_t { Sin, Cos, Tan };
+
+// pi / 180 split in two, so the remainder converts with a rounding error well below an ulp
+constexpr double RadiansPerDegree = 0.017453292519943295;
+constexpr double RadiansPerDegreeLow = 2.9486522708701687e-19;
+constexpr double LargeAngle = 17592186044416.0; // 2^44: 360k stays exact below this
+
+// --trig=libm|poly|table
+inline bool parseMode(std::string_view text, Mode& mode) {
+    if (text == "libm") mode = Mode::Libm;
+    else if (text == "poly" || text == "polynomial") mode = Mode::Polynomial;
+    else if (text == "table") mode = Mode::Table;
+    else return false;
+    return true;
+}
+
+// Rounds to the nearest integer for |x| < 2^51: adding 1.5 * 2^52 pushes the fraction out of the
+// mantissa. Unlike std::nearbyint this is plain arithmetic, so loops using it vectorize.
+constexpr double RoundingShift = 6755399441055744.0;
+
+inline double roundNearest(double x) { return (x + RoundingShift) - RoundingShift; }
+
+// Quadrant (0..3) and remainder in [-45, 45] degrees, r = x - 90 * quadrant exactly.
+// Only valid for |degrees| < LargeAngle; evaluate() sends larger angles through std::fmod first.
+inline double reduce(double degrees, uint64_t& quadrant) {
+    double turn = degrees - roundNearest(degrees * (1.0 / 360.0)) * 360.0;
+    double shifted = turn * (1.0 / 90.0) + RoundingShift;
+    std::memcpy(&quadrant, &shifted, sizeof quadrant); // The low mantissa bits hold the rounded value
+    quadrant &= 3;
+    return turn - (shifted - RoundingShift) * 90.0;
+}
+
+inline double toRadians(double degrees) { return degrees * RadiansPerDegree + degrees * RadiansPerDegreeLow; }
+
+// fdlibm __kernel_sin / __kernel_cos: minimax on [-pi/4, pi/4], |error| < 2^-58
+inline double kernelSin(double x) {
+    const double S1 = -1.66666666666666324348e-01, S2 = 8.33333333332248946124e-03, S3 = -1.98412698298579493134e-04,
+                 S4 = 2.75573137070700676789e-06, S5 = -2.50507602534068634195e-08, S6 = 1.58969099521155010221e-10;
+    double z = x * x;
+    double r = S2 + z * (S3 + z * (S4 + z * (S5 + z * S6)));
+    return x + z * x * (S1 + z * r);
+}
+
+inline double kernelCos(double x) {
+    const double C1 = 4.16666666666666019037e-02, C2 = -1.38888888888741095749e-03, C3 = 2.48015872894767294178e-05,
+                 C4 = -2.75573143513906633035e-07, C5 = 2.08757232129817482790e-09, C6 = -1.13596475577881948265e-11;
+    double z = x * x;
+    double r = z * (C1 + z * (C2 + z * (C3 + z * (C4 + z * (C5 + z * C6)))));
+    double half = 0.5 * z, w = 1.0 - half;
+    return w + (((1.0 - w) - half) + z * r); // Recovers the bits 1 - z/2 rounds away
+}
+
+// sin and cos of whole degrees 0..45, rounded from long double
+struct Table {
+    double sin[46], cos[46];
+    Table() {
+        const long double radians = 3.141592653589793238462643383279502884L / 180;
+        for (int i = 0; i <= 45; i++) {
+            sin[i] = double(std::sin(i * radians));
+            cos[i] = double(std::cos(i * radians));
+        }
+    }
+};
+
+inline const Table& table() {
+    static const Table instance;
+    return instance;
+}
+
+// sin and cos of r in [-45, 45] degrees. Templates rather than a runtime switch keep the
+// array loops free of branches, which the vectorizer needs.
+template <Mode M>
+inline void sinCos(double r, const Table& t, double& s, double& c) {
+    if (M == Mode::Polynomial) {
+        double x = toRadians(r);
+        s = kernelSin(x);
+        c = kernelCos(x);
+        return;
+    }
+    double whole = roundNearest(r);
+    double b = toRadians(r - whole); // |b| <= 0.5 degrees, about 0.0087 radians
+    int index = int(std::fabs(whole));
+    double sa = std::copysign(t.sin[index], whole), ca = t.cos[index];
+    double z = b * b;
+    double sb = b + b * z * (-1.0 / 6 + z * (1.0 / 120 - z * (1.0 / 5040)));
+    double oneMinusCb = z * (0.5 - z * (1.0 / 24 - z * (1.0 / 720)));
+    s = sa + (ca * sb - sa * oneMinusCb); // sin(a + b), small terms summed first
+    c = ca - (sa * sb + ca * oneMinusCb);
+}
+
+// Puts sin / cos / tan of the reduced angle back in the quadrant of the original one.
+// 0.0 - v negates without producing -0, so sin(180) prints as 0.
+template <Function F>
+inline double unreduce(uint64_t quadrant, double s, double c) {
+    bool odd = quadrant & 1;
+    if (F == Function::Sin) {
+        double v = odd ? c : s;
+        return quadrant & 2 ? 0.0 - v : v;
+    }
+    if (F == Function::Cos) {
+        double v = odd ? s : c;
+        return (quadrant + 1) & 2 ? 0.0 - v : v;
+    }
+    return (odd ? c : s) / (odd ? 0.0 - s : c); // tan(90) is +inf, not -inf
+}
+
+inline double libm(Function function, double degrees) {
+    double radians = degrees * M_PI / 180.0;
+    return function == Function::Sin ? std::sin(radians) : function == Function::Cos ? std::cos(radians) : std::tan(radians);
+}
+
+template <Function F, Mode M>
+inline double evaluate(double degrees) {
+    // Reducing inf or NaN would leave a NaN quadrant and table index; inf - inf is NaN, NaN stays NaN
+    if (!std::isfinite(degrees)) return degrees - degrees;
+    if (!(std::fabs(degrees) < LargeAngle)) degrees = std::fmod(degrees, 360.0); // Exact
+    uint64_t quadrant;
+    double s, c;
+    sinCos<M>(reduce(degrees, quadrant), table(), s, c);
+    return unreduce<F>(quadrant, s, c);
+}
+
+template <Function F, Mode M>
+inline void evaluate(const double* degrees, double* out, size_t n) {
+    // Any angle that needs std::fmod, and any inf or NaN (the comparison is false for both), sends the
+    // whole array down the scalar path
+    size_t large = 0;
+    for (size_t i = 0; i < n; i++) large += !(std::fabs(degrees[i]) < LargeAngle);
+    if (large) {
+        for (size_t i = 0; i < n; i++) out[i] = evaluate<F, M>(degrees[i]);
+        return;
+    }
+    const Table& t = table();
+    for (size_t i = 0; i < n; i++) {
+        uint64_t quadrant;
+        double s, c;
+        sinCos<M>(reduce(degrees[i], quadrant), t, s, c);
+        out[i] = unreduce<F>(quadrant, s, c);
+    }
+}
+
+inline double evaluate(Function function, Mode mode, double degrees) {
+    bool table = mode == Mode::Table;
+    switch (mode == Mode::Libm ? Function(3) : function) {
+        case Function::Sin: return table ? evaluate<Function::Sin, Mode::Table>(degrees) : evaluate<Function::Sin, Mode::Polynomial>(degrees);
+        case Function::Cos: return table ? evaluate<Function::Cos, Mode::Table>(degrees) : evaluate<Function::Cos, Mode::Polynomial>(degrees);
+        case Function::Tan: return table ? evaluate<Function::Tan, Mode::Table>(degrees) : evaluate<Function::Tan, Mode::Polynomial>(degrees);
+    }
+    return libm(function, degrees);
+}
+
+// out[i] = function(degrees[i]) for i in [0, n); out may be the same array as degrees
+inline void evaluate(Function function, Mode mode, const double* degrees, double* out, size_t n) {
+    bool table = mode == Mode::Table;
+    switch (mode == Mode::Libm ? Function(3) : function) {
+        case Function::Sin: return table ? evaluate<Function::Sin, Mode::Table>(degrees, out, n) : evaluate<Function::Sin, Mode::Polynomial>(degrees, out, n);
+        case Function::Cos: return table ? evaluate<Function::Cos, Mode::Table>(degrees, out, n) : evaluate<Function::Cos, Mode::Polynomial>(degrees, out, n);
+        case Function::Tan: return table ? evaluate<Function::Tan, Mode::Table>(degrees, out, n) : evaluate<Function::Tan, Mode::Polynomial>(degrees, out, n);
+    }
+    for (size_t i = 0; i < n; i++) out[i] = libm(function, degrees[i]);
+}
+
+} // namespace fasttrig
+
+#endif
@@ -6,11 +6,14 @@
 #include <map>
 #include <iomanip>
 #include <sstream>
+#include <memory>
+#include <string_view>
+#include <new>
 
 // Context
 class Context {
 public:
-    std::map<std::string, double> variables;
+    std::map<std::string, double, std::less<>> variables; // std::less<> allows lookups by string_view
 };
 
 // Abstract Expression Interface
@@ -20,6 +23,58 @@ public:
     virtual ~Expression() {} 
 };
 
+// Bump allocator that owns every node of an expression tree.
+// Nodes hold no resources of their own, so the whole tree is released at once by reset().
+class ExpressionArena {
+private:
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::vector<size_t> sizes;
+    size_t current = 0; // Block currently being bumped
+    size_t offset = 0;  // Next free byte in that block
+
+    void* allocate(size_t size, size_t align) {
+        while (true) {
+            if (current < blocks.size()) {
+                size_t aligned = (offset + align - 1) & ~(align - 1);
+                if (aligned + size <= sizes[current]) {
+                    offset = aligned + size;
+                    return blocks[current].get() + aligned;
+                }
+                if (current + 1 < blocks.size()) { // Reuse a block kept from an earlier tree
+                    current++;
+                    offset = 0;
+                    continue;
+                }
+            }
+            size_t blockSize = blocks.empty() ? 4096 : sizes.back() * 2;
+            while (blockSize < size + align) blockSize *= 2;
+            blocks.emplace_back(new char[blockSize]);
+            sizes.push_back(blockSize);
+            current = blocks.size() - 1;
+            offset = 0;
+        }
+    }
+
+public:
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    std::string_view copyString(std::string_view text) {
+        char* data = static_cast<char*>(allocate(text.size() + 1, 1));
+        text.copy(data, text.size());
+        data[text.size()] = '\0';
+        return std::string_view(data, text.size());
+    }
+
+    // Frees every node in one step, keeping the blocks for the next tree
+    void reset() {
+        current = 0;
+        offset = 0;
+    }
+};
+
 // Terminal Expression (NumberExpression)
 class NumberExpression : public Expression {
 private:
@@ -35,15 +90,16 @@ public:
 // Terminal Expression (VariableExpression)
 class VariableExpression : public Expression {
 private:
-    std::string name;
+    std::string_view name; // Points into the arena that owns this node
 
 public:
-    VariableExpression(const std::string& name) : name(name) {}
+    VariableExpression(std::string_view name) : name(name) {}
     double interpret(Context& context) override {
-        if (context.variables.find(name) != context.variables.end()) {
-            return context.variables[name];
+        auto it = context.variables.find(name);
+        if (it != context.variables.end()) {
+            return it->second;
         }
-        throw std::runtime_error("Undefined variable: " + name);
+        throw std::runtime_error("Undefined variable: " + std::string(name));
     }
 };
 
@@ -55,10 +111,6 @@ protected:
 
 public:
     BinaryExpression(Expression* left, Expression* right) : left(left), right(right) {}
-    virtual ~BinaryExpression() {
-        delete left;
-        delete right;
-    }
 };
 
 class AdditionExpression : public BinaryExpression {
@@ -99,6 +151,7 @@ public:
 class Interpreter {
 private:
     Context* context;
+    ExpressionArena arena; // Owns the nodes of the tree being evaluated
     std::map<char, int> precedence = {{'+', 1}, {'-', 1}, {'*', 2}, {'/', 2}};
 
 public:
@@ -114,15 +167,14 @@ public:
                 std::string expr = token.substr(eq_pos + 1);
                 trim(var);
                 trim(expr);
-                Expression* expressionTree = buildExpressionTree(tokenize(expr));
+                arena.reset(); // Releases the previous tree in one step
+                Expression* expressionTree = buildExpressionTree(tokenize(expr), arena);
                 double value = expressionTree->interpret(*context);
                 context->variables[var] = value;
-                delete expressionTree;
             } else {
-                Expression* expressionTree = buildExpressionTree(tokenize(token));
-                double result = expressionTree->interpret(*context);
-                delete expressionTree;
-                return result;
+                arena.reset();
+                Expression* expressionTree = buildExpressionTree(tokenize(token), arena);
+                return expressionTree->interpret(*context);
             }
         }
         return 0;
@@ -153,46 +205,46 @@ private:
         return tokens;
     }
 
-    Expression* buildExpressionTree(const std::vector<std::string>& tokens) {
+    Expression* buildExpressionTree(const std::vector<std::string>& tokens, ExpressionArena& arena) {
         std::stack<Expression*> values;
         std::stack<char> operators;
         
         for (const std::string& token : tokens) {
             if (std::isdigit(token[0]) || token.find('.') != std::string::npos) {
-                values.push(new NumberExpression(std::stod(token)));
+                values.push(arena.create<NumberExpression>(std::stod(token)));
             } else if (std::isalpha(token[0])) {
-                values.push(new VariableExpression(token));
+                values.push(arena.create<VariableExpression>(arena.copyString(token)));
             } else if (token == "(") {
                 operators.push('(');
             } else if (token == ")") {
                 while (!operators.empty() && operators.top() != '(') {
-                    applyOperator(values, operators);
+                    applyOperator(values, operators, arena);
                 }
                 operators.pop();
             } else if (token == "+" || token == "-" || token == "*" || token == "/") {
                 while (!operators.empty() && operators.top() != '(' && precedence[operators.top()] >= precedence[token[0]]) {
-                    applyOperator(values, operators);
+                    applyOperator(values, operators, arena);
                 }
                 operators.push(token[0]);
             }
         }
         
         while (!operators.empty()) {
-            applyOperator(values, operators);
+            applyOperator(values, operators, arena);
         }
         return values.top();
     }
 
-    void applyOperator(std::stack<Expression*>& values, std::stack<char>& operators) {
+    void applyOperator(std::stack<Expression*>& values, std::stack<char>& operators, ExpressionArena& arena) {
         char op = operators.top(); operators.pop();
         Expression* right = values.top(); values.pop();
         Expression* left = values.top(); values.pop();
         
         switch (op) {
-            case '+': values.push(new AdditionExpression(left, right)); break;
-            case '-': values.push(new SubtractionExpression(left, right)); break;
-            case '*': values.push(new MultiplicationExpression(left, right)); break;
-            case '/': values.push(new DivisionExpression(left, right)); break;
+            case '+': values.push(arena.create<AdditionExpression>(left, right)); break;
+            case '-': values.push(arena.create<SubtractionExpression>(left, right)); break;
+            case '*': values.push(arena.create<MultiplicationExpression>(left, right)); break;
+            case '/': values.push(arena.create<DivisionExpression>(left, right)); break;
         }
     }
     
@@ -2,26 +2,144 @@
 #include <fstream>  // For file handling
 #include <string>
 #include <vector>
-#include <stack>
 #include <cctype>
 #include <map>
 #include <iomanip>
 #include <sstream>
+#include <memory>
+#include <string_view>
+#include <new>
+#include <chrono>
 #include <cmath> 
+#include <cstdint>
+#include <charconv>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <list>
+#include <iterator>
+#include <future>   // Subtrees of very large expressions are evaluated on other threads
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include "binary_log.h" // Asynchronous binary calculation log
+#include "epoch.h"      // Published versions of a SharedContext
 
 // Context
 class Context {
 public:
-    std::map<std::string, double> variables;
+    std::map<std::string, double, std::less<>> variables; // std::less<> allows lookups by string_view
+};
+
+// Lexical token: a view into the source text plus, for numbers, the value parsed up front
+enum class TokenKind : uint8_t { Number, MalformedNumber, Name, Operator, LeftParen, RightParen, Comma, Assign };
+
+struct Token {
+    TokenKind kind;
+    std::string_view text;
+    double number;
+};
+
+// Node kinds, shared by the tree and the flat representation
+enum class OpCode : uint8_t {
+    Number, Variable, Add, Subtract, Multiply, Divide, Modulo,
+    CheckDivisor, CheckModulus, // Flat form only: zero test that runs before the left operand
+    Subtree                     // Flat form only: value of a subtree split off to be evaluated on its own
 };
 
 // Abstract Expression Interface
 class Expression {
 public:
     virtual double interpret(Context& context) = 0;
+    virtual OpCode opcode() const = 0;
     virtual ~Expression() {} 
 };
 
+// Bump allocator that owns every node of an expression tree.
+// Nodes hold no resources of their own, so the whole tree is released at once by reset().
+class ExpressionArena {
+private:
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::vector<size_t> sizes;
+    size_t current = 0; // Block currently being bumped
+    size_t offset = 0;  // Next free byte in that block
+
+    void* allocate(size_t size, size_t align) {
+        while (true) {
+            if (current < blocks.size()) {
+                size_t aligned = (offset + align - 1) & ~(align - 1);
+                if (aligned + size <= sizes[current]) {
+                    offset = aligned + size;
+                    return blocks[current].get() + aligned;
+                }
+                if (current + 1 < blocks.size()) { // Reuse a block kept from an earlier tree
+                    current++;
+                    offset = 0;
+                    continue;
+                }
+            }
+            size_t blockSize = blocks.empty() ? 4096 : sizes.back() * 2;
+            while (blockSize < size + align) blockSize *= 2;
+            blocks.emplace_back(new char[blockSize]);
+            sizes.push_back(blockSize);
+            current = blocks.size() - 1;
+            offset = 0;
+        }
+    }
+
+public:
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    std::string_view copyString(std::string_view text) {
+        char* data = static_cast<char*>(allocate(text.size() + 1, 1));
+        text.copy(data, text.size());
+        data[text.size()] = '\0';
+        return std::string_view(data, text.size());
+    }
+
+// Frees every node in one step, keeping the blocks for the next tree
+    void reset() {
+        current = 0;
+        offset = 0;
+    }
+};
+
+// Allocates every node with its own new, used as the baseline in the arena benchmark
+class HeapAllocator {
+private:
+    std::vector<Expression*> nodes;
+    std::vector<char*> strings;
+
+public:
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        T* node = new T(std::forward<Args>(args)...);
+        nodes.push_back(node);
+        return node;
+    }
+
+    std::string_view copyString(std::string_view text) {
+        char* data = new char[text.size() + 1];
+        text.copy(data, text.size());
+        data[text.size()] = '\0';
+        strings.push_back(data);
+        return std::string_view(data, text.size());
+    }
+
+    void reset() {
+        for (Expression* node : nodes) delete node;
+        for (char* data : strings) delete[] data;
+        nodes.clear();
+        strings.clear();
+    }
+
+    ~HeapAllocator() { reset(); }
+};
+
 // Terminal Expression (NumberExpression)
 class NumberExpression : public Expression {
 private:
@@ -32,21 +150,26 @@ public:
     double interpret(Context& context) override {
         return number;
     }
+    OpCode opcode() const override { return OpCode::Number; }
+    double value() const { return number; }
 };
 
 // Terminal Expression (VariableExpression)
 class VariableExpression : public Expression {
 private:
-    std::string name;
+    std::string_view name; // Points into the arena that owns this node
 
 public:
-    VariableExpression(const std::string& name) : name(name) {}
+    VariableExpression(std::string_view name) : name(name) {}
     double interpret(Context& context) override {
-        if (context.variables.find(name) != context.variables.end()) {
-            return context.variables[name];
+        auto it = context.variables.find(name);
+        if (it != context.variables.end()) {
+            return it->second;
         }
-        throw std::runtime_error("Undefined variable: " + name);
+        throw std::runtime_error("Undefined variable: " + std::string(name));
     }
+    OpCode opcode() const override { return OpCode::Variable; }
+    std::string_view variableName() const { return name; }
 };
 
 // Non-Terminal Expressions
@@ -57,15 +180,14 @@ protected:
 
 public:
     BinaryExpression(Expression* left, Expression* right) : left(left), right(right) {}
-    virtual ~BinaryExpression() {
-        delete left;
-        delete right;
-    }
+    Expression* leftOperand() const { return left; }
+    Expression* rightOperand() const { return right; }
 };
 
 class AdditionExpression : public BinaryExpression {
 public:
     AdditionExpression(Expression* left, Expression* right) : BinaryExpression(left, right) {}
+    OpCode opcode() const override { return OpCode::Add; }
     double interpret(Context& context) override {
         return left->interpret(context) + right->interpret(context);
     }
@@ -74,6 +196,7 @@ public:
 class SubtractionExpression : public BinaryExpression {
 public:
     SubtractionExpression(Expression* left, Expression* right) : BinaryExpression(left, right) {}
+    OpCode opcode() const override { return OpCode::Subtract; }
     double interpret(Context& context) override {
         return left->interpret(context) - right->interpret(context);
     }
@@ -82,6 +205,7 @@ public:
 class MultiplicationExpression : public BinaryExpression {
 public:
     MultiplicationExpression(Expression* left, Expression* right) : BinaryExpression(left, right) {}
+    OpCode opcode() const override { return OpCode::Multiply; }
     double interpret(Context& context) override {
         return left->interpret(context) * right->interpret(context);
     }
@@ -90,6 +214,7 @@ public:
 class DivisionExpression : public BinaryExpression {
 public:
     DivisionExpression(Expression* left, Expression* right) : BinaryExpression(left, right) {}
+    OpCode opcode() const override { return OpCode::Divide; }
     double interpret(Context& context) override {
         double denominator = right->interpret(context);
         if (denominator == 0) throw std::runtime_error("Division by Zero error");
@@ -100,6 +225,7 @@ public:
 class ModuloExpression : public BinaryExpression {
 public:
     ModuloExpression(Expression* left, Expression*right): BinaryExpression(left,right) {}
+    OpCode opcode() const override { return OpCode::Modulo; }
     double interpret(Context& context) override {
         double deno = right->interpret(context);
         if (deno == 0) throw std::runtime_error("Modulo By Zero Error");
@@ -107,141 +233,1325 @@ public:
     }
 };
 
-// Interpreter
-class Interpreter {
+// Devirtualized form of an expression tree: nodes sit in one array in post-order,
+// so evaluation is a single forward loop with a switch instead of virtual calls.
+struct FlatNode {
+    OpCode op;
+    uint32_t lhs; // Left child, constant index, variable index or subtree index depending on op
+    uint32_t rhs; // Right child for binary nodes
+};
+
+// When a flat expression splits independent subtrees off to be evaluated on other threads
+struct ForkOptions {
+    size_t threshold = size_t(1) << 16; // Expressions with fewer nodes always run on the calling thread
+    size_t cutoff = size_t(1) << 13;    // Subtrees smaller than this stay with their parent
+    unsigned maxTasks = std::max(1u, std::thread::hardware_concurrency()); // Threads used at most, the caller included
+};
+
+class FlatExpression {
 private:
-    Context* context;
-    std::map<char, int> precedence = {{'+', 1}, {'-', 1}, {'*', 2}, {'/', 2}, {'%', 2}};
+    // Decides which subtrees become tasks: both operands of a node must have at least cutoff nodes
+    struct ForkPlan {
+        std::unordered_map<const Expression*, size_t> weights; // Nodes in each subtree counted as a tree, saturating
+        size_t cutoff;
+        unsigned tasksLeft;
+
+        size_t weight(const Expression* expression) const { return weights.at(expression); }
+
+        // Fills weights bottom-up with an explicit stack
+        void measure(const Expression* root) {
+            std::vector<const Expression*> pending{root};
+            while (!pending.empty()) {
+                const Expression* expression = pending.back();
+                if (weights.count(expression)) {
+                    pending.pop_back();
+                    continue;
+                }
+                if (expression->opcode() == OpCode::Number || expression->opcode() == OpCode::Variable) {
+                    weights.emplace(expression, 1);
+                    pending.pop_back();
+                    continue;
+                }
+                auto binary = static_cast<const BinaryExpression*>(expression);
+                auto left = weights.find(binary->leftOperand()), right = weights.find(binary->rightOperand());
+                if (left == weights.end() || right == weights.end()) {
+                    if (left == weights.end()) pending.push_back(binary->leftOperand());
+                    if (right == weights.end()) pending.push_back(binary->rightOperand());
+                    continue;
+                }
+                size_t total = left->second + right->second + 1;
+                weights.emplace(expression, total < left->second ? SIZE_MAX : total);
+                pending.pop_back();
+            }
+        }
+
+        bool fork(const BinaryExpression* binary) {
+            if (tasksLeft <= 1) return false;
+            if (weight(binary->leftOperand()) < cutoff || weight(binary->rightOperand()) < cutoff) return false;
+            tasksLeft--;
+            return true;
+        }
+    };
+
+    std::vector<FlatNode> nodes;
+    std::vector<double> constants;
+    std::vector<std::string> names;     // Distinct variables, looked up once per evaluation
+    mutable std::vector<double> values; // Scratch result per node, reused between evaluations
+    mutable std::vector<const double*> bindings;
+    std::unordered_map<const Expression*, uint32_t> emitted; // Shared subtrees are laid out once
+    std::vector<std::unique_ptr<FlatExpression>> subtrees;   // Split off by a ForkPlan, evaluated before nodes
+    mutable std::vector<double> subtreeValues;
+    mutable std::vector<std::exception_ptr> subtreeErrors; // Rethrown where the subtree sits in evaluation order
+
+    FlatExpression(const Expression* root, ForkPlan* plan) {
+        append(root, plan);
+        allocateScratch();
+    }
+
+    void allocateScratch() {
+        values.resize(nodes.size());
+        bindings.resize(names.size());
+        subtreeValues.resize(subtrees.size());
+        subtreeErrors.resize(subtrees.size());
+    }
+
+    uint32_t finish(const Expression* expression, FlatNode node) {
+        nodes.push_back(node);
+        emitted[expression] = nodes.size() - 1;
+        return nodes.size() - 1;
+    }
+
+    // Lays the tree out in post-order. An explicit stack replaces recursion, so a degenerate tree
+    // hundreds of thousands of levels deep needs heap memory, not call stack.
+    void append(const Expression* root, ForkPlan* plan) {
+        struct Frame {
+            const Expression* expression;
+            uint8_t stage; // Operands laid out so far
+            bool fork;     // Whether the first operand becomes a subtree task
+            FlatNode node;
+        };
+        std::vector<Frame> stack{{root, 0, false, {}}};
+        uint32_t last = 0; // Index of the node that finished most recently
+        while (!stack.empty()) {
+            Frame& frame = stack.back();
+            const Expression* expression = frame.expression;
+            if (frame.stage == 0) {
+                auto done = emitted.find(expression);
+                if (done != emitted.end()) {
+                    last = done->second;
+                    stack.pop_back();
+                    continue;
+                }
+                frame.node = FlatNode{expression->opcode(), 0, 0};
+                if (frame.node.op == OpCode::Number) {
+                    frame.node.lhs = constants.size();
+                    constants.push_back(static_cast<const NumberExpression*>(expression)->value());
+                    last = finish(expression, frame.node);
+                    stack.pop_back();
+                    continue;
+                }
+                if (frame.node.op == OpCode::Variable) {
+                    std::string_view name = static_cast<const VariableExpression*>(expression)->variableName();
+                    while (frame.node.lhs < names.size() && names[frame.node.lhs] != name) frame.node.lhs++;
+                    if (frame.node.lhs == names.size()) names.emplace_back(name);
+                    last = finish(expression, frame.node);
+                    stack.pop_back();
+                    continue;
+                }
+                frame.fork = plan && plan->fork(static_cast<const BinaryExpression*>(expression));
+            }
+            auto binary = static_cast<const BinaryExpression*>(expression);
+            // The tree checks the divisor before it evaluates the left operand, keep that order for errors
+            bool divides = frame.node.op == OpCode::Divide || frame.node.op == OpCode::Modulo;
+            const Expression* first = divides ? binary->rightOperand() : binary->leftOperand();
+            const Expression* second = divides ? binary->leftOperand() : binary->rightOperand();
+            if (frame.stage == 1) {
+                (divides ? frame.node.rhs : frame.node.lhs) = last;
+                if (divides && second->opcode() != OpCode::Number) {
+                    nodes.push_back({frame.node.op == OpCode::Divide ? OpCode::CheckDivisor : OpCode::CheckModulus, last, 0});
+                }
+            } else if (frame.stage == 2) {
+                (divides ? frame.node.lhs : frame.node.rhs) = last;
+                last = finish(expression, frame.node);
+                stack.pop_back();
+                continue;
+            }
+            const Expression* operand = frame.stage++ == 0 ? first : second;
+            if (operand == first && frame.fork && !emitted.count(operand)) {
+                subtrees.emplace_back(new FlatExpression(operand, plan));
+                last = finish(operand, {OpCode::Subtree, uint32_t(subtrees.size() - 1), 0});
+                continue;
+            }
+            stack.push_back({operand, 0, false, {}}); // frame is not used past this point
+        }
+    }
+
+    // Evaluates the split-off subtrees, all but the last on their own threads, and waits for every one
+    void evaluateSubtrees(const Context& context) const {
+        std::vector<std::future<double>> tasks;
+        for (size_t i = 0; i + 1 < subtrees.size(); i++) {
+            const FlatExpression* subtree = subtrees[i].get();
+            tasks.push_back(std::async(std::launch::async, [subtree, &context] { return subtree->interpret(context); }));
+        }
+        for (size_t i = 0; i < subtrees.size(); i++) {
+            subtreeErrors[i] = nullptr;
+            try {
+                subtreeValues[i] = i < tasks.size() ? tasks[i].get() : subtrees[i]->interpret(context);
+            } catch (...) {
+                subtreeErrors[i] = std::current_exception();
+            }
+        }
+    }
 
 public:
-    Interpreter(Context* context) : context(context) {}
+    explicit FlatExpression(const Expression* root) : FlatExpression(root, nullptr) {}
+
+    // Splits off independent subtrees as tasks when the expression has at least options.threshold nodes
+    FlatExpression(const Expression* root, const ForkOptions& options) {
+        ForkPlan plan{{}, std::max<size_t>(options.cutoff, 1), options.maxTasks};
+        if (options.maxTasks > 1) plan.measure(root);
+        bool fork = options.maxTasks > 1 && plan.weight(root) >= options.threshold;
+        append(root, fork ? &plan : nullptr);
+        allocateScratch();
+    }
+
+    size_t size() const { return nodes.size(); }
+
+    // Value a subtree of the root had in the last interpret(); false if it was not laid out here
+    // (it sits inside a subtree evaluated as a task)
+    bool valueOf(const Expression* expression, double& value) const {
+        auto it = emitted.find(expression);
+        if (it == emitted.end()) return false;
+        value = values[it->second];
+        return true;
+    }
 
-    double interpret(std::string input) {
-        std::istringstream iss(input);
-        std::string token;
-        while (std::getline(iss, token, ',')) {
-            size_t eq_pos = token.find('=');
-            if (eq_pos != std::string::npos) {
-                std::string var = token.substr(0, eq_pos);
-                std::string expr = token.substr(eq_pos + 1);
-                trim(var);
-                trim(expr);
-                Expression* expressionTree = buildExpressionTree(tokenize(expr));
-                double value = expressionTree->interpret(*context);
-                context->variables[var] = value;
-                delete expressionTree;
-                return value;
-            } else {
-                Expression* expressionTree = buildExpressionTree(tokenize(token));
-                double result = expressionTree->interpret(*context);
-                delete expressionTree;
-                return result;
+    size_t tasks() const { // Subtrees evaluated as tasks, nested ones included
+        size_t count = subtrees.size();
+        for (const auto& subtree : subtrees) count += subtree->tasks();
+        return count;
+    }
+
+    // Variables are only read, so the subtree tasks share context without locking
+    double interpret(const Context& context) const {
+        if (!subtrees.empty()) evaluateSubtrees(context);
+        for (size_t i = 0; i < names.size(); i++) {
+            auto it = context.variables.find(names[i]);
+            bindings[i] = it == context.variables.end() ? nullptr : &it->second;
+        }
+        double* v = values.data();
+        for (size_t i = 0; i < nodes.size(); i++) {
+            const FlatNode& node = nodes[i];
+            switch (node.op) {
+                case OpCode::Number: v[i] = constants[node.lhs]; break;
+                case OpCode::Variable:
+                    if (!bindings[node.lhs]) throw std::runtime_error("Undefined variable: " + names[node.lhs]);
+                    v[i] = *bindings[node.lhs];
+                    break;
+                case OpCode::Add: v[i] = v[node.lhs] + v[node.rhs]; break;
+                case OpCode::Subtract: v[i] = v[node.lhs] - v[node.rhs]; break;
+                case OpCode::Multiply: v[i] = v[node.lhs] * v[node.rhs]; break;
+                case OpCode::Divide:
+                    if (v[node.rhs] == 0) throw std::runtime_error("Division by Zero error");
+                    v[i] = v[node.lhs] / v[node.rhs];
+                    break;
+                case OpCode::Modulo:
+                    if (v[node.rhs] == 0) throw std::runtime_error("Modulo By Zero Error");
+                    v[i] = std::fmod(v[node.lhs], v[node.rhs]);
+                    break;
+                case OpCode::CheckDivisor:
+                    if (v[node.lhs] == 0) throw std::runtime_error("Division by Zero error");
+                    break;
+                case OpCode::CheckModulus:
+                    if (v[node.lhs] == 0) throw std::runtime_error("Modulo By Zero Error");
+                    break;
+                case OpCode::Subtree:
+                    if (subtreeErrors[node.lhs]) std::rethrow_exception(subtreeErrors[node.lhs]);
+                    v[i] = subtreeValues[node.lhs];
+                    break;
             }
         }
-        return 0;
+        return v[nodes.size() - 1]; // The root comes last in post-order
     }
+};
 
+// Node counts of one expression before and after optimization
+struct OptimizationStats {
+    size_t nodesBefore = 0;
+    size_t nodesAfter = 0;
+};
+
+// Rewrites a tree into a smaller DAG in the same arena:
+//  - folds operators whose operands are both constants (division or modulo by a constant zero is left for the runtime error)
+//  - drops identities that are exact for every double: x*1, 1*x, x/1, x-0, x+(-0)
+//  - strength-reduces x/2^k to x*2^-k and x*2 to x+x for variables
+//  - shares structurally equal subtrees, so the flat form evaluates each of them once
+// x+0 and x*0 are kept: they change the sign of zero or hide NaN, infinity and undefined variables.
+class ExpressionOptimizer {
 private:
-    std::vector<std::string> tokenize(const std::string& input) {
-        std::vector<std::string> tokens;
-        std::string number;
-        
-        for (size_t i = 0; i < input.size(); i++) {
-            char c = input[i];
-            if (std::isalnum(c) || c == '.') {
-                number += c;
-            } else {
-                if (!number.empty()) {
-                    tokens.push_back(number);
-                    number.clear();
+    struct NodeKey {
+        OpCode op;
+        const Expression* left;
+        const Expression* right;
+        uint64_t bits; // Value of numbers
+
+        bool operator==(const NodeKey& other) const {
+            return op == other.op && left == other.left && right == other.right && bits == other.bits;
+        }
+    };
+    struct NodeKeyHash {
+        size_t operator()(const NodeKey& key) const {
+            size_t h = std::hash<uint64_t>()(key.bits) ^ static_cast<size_t>(key.op);
+            h = h * 31 + std::hash<const void*>()(key.left);
+            return h * 31 + std::hash<const void*>()(key.right);
+        }
+    };
+
+    ExpressionArena& arena;
+    std::unordered_map<NodeKey, Expression*, NodeKeyHash> unique;
+    std::unordered_map<std::string_view, Expression*> variables;
+
+    static uint64_t bitsOf(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof bits);
+        return bits;
+    }
+
+    static bool isNumber(const Expression* e, double value) {
+        return e->opcode() == OpCode::Number && bitsOf(static_cast<const NumberExpression*>(e)->value()) == bitsOf(value);
+    }
+
+    Expression* number(double value) {
+        Expression*& node = unique[NodeKey{OpCode::Number, nullptr, nullptr, bitsOf(value)}];
+        if (!node) node = arena.create<NumberExpression>(value);
+        return node;
+    }
+
+    Expression* binary(OpCode op, Expression* left, Expression* right) {
+        Expression*& node = unique[NodeKey{op, left, right, 0}];
+        if (!node) {
+            switch (op) {
+                case OpCode::Add: node = arena.create<AdditionExpression>(left, right); break;
+                case OpCode::Subtract: node = arena.create<SubtractionExpression>(left, right); break;
+                case OpCode::Multiply: node = arena.create<MultiplicationExpression>(left, right); break;
+                case OpCode::Divide: node = arena.create<DivisionExpression>(left, right); break;
+                default: node = arena.create<ModuloExpression>(left, right); break;
+            }
+        }
+        return node;
+    }
+
+    Expression* leaf(Expression* expression) {
+        if (expression->opcode() == OpCode::Number) return number(static_cast<NumberExpression*>(expression)->value());
+        auto variable = static_cast<VariableExpression*>(expression);
+        Expression*& node = variables[variable->variableName()];
+        if (!node) node = variable;
+        return node;
+    }
+
+    // The node for op applied to already optimized operands
+    Expression* rewrite(OpCode op, Expression* left, Expression* right) {
+        if (left->opcode() == OpCode::Number && right->opcode() == OpCode::Number) {
+            double a = static_cast<NumberExpression*>(left)->value(), b = static_cast<NumberExpression*>(right)->value();
+            switch (op) {
+                case OpCode::Add: return number(a + b);
+                case OpCode::Subtract: return number(a - b);
+                case OpCode::Multiply: return number(a * b);
+                case OpCode::Divide: if (b != 0) return number(a / b); break;
+                case OpCode::Modulo: if (b != 0) return number(std::fmod(a, b)); break;
+                default: break;
+            }
+        }
+        switch (op) {
+            case OpCode::Add:
+                if (isNumber(right, -0.0)) return left;
+                if (isNumber(left, -0.0)) return right;
+                break;
+            case OpCode::Subtract:
+                if (isNumber(right, 0.0)) return left;
+                break;
+            case OpCode::Multiply:
+                if (isNumber(right, 1.0)) return left;
+                if (isNumber(left, 1.0)) return right;
+                // x+x reads x twice, which only costs nothing when x is a leaf
+                if (isNumber(right, 2.0) && left->opcode() == OpCode::Variable) return binary(OpCode::Add, left, left);
+                if (isNumber(left, 2.0) && right->opcode() == OpCode::Variable) return binary(OpCode::Add, right, right);
+                break;
+            case OpCode::Divide:
+                if (isNumber(right, 1.0)) return left;
+                if (right->opcode() == OpCode::Number) {
+                    double divisor = static_cast<NumberExpression*>(right)->value();
+                    int exponent;
+                    double reciprocal = 1.0 / divisor;
+                    // Only a power of two has an exact reciprocal, so x*(1/c) rounds exactly like x/c
+                    if (std::isfinite(divisor) && std::fabs(std::frexp(divisor, &exponent)) == 0.5 && std::isnormal(reciprocal)) {
+                        return binary(OpCode::Multiply, left, number(reciprocal));
+                    }
                 }
-                if (c == '+' || c == '-' || c == '*' || c == '/' || c == '%' || c == '(' || c == ')') {
-                    tokens.push_back(std::string(1, c));
+                break;
+            default:
+                break;
+        }
+        return binary(op, left, right);
+    }
+
+public:
+    explicit ExpressionOptimizer(ExpressionArena& arena) : arena(arena) {}
+
+    // Walks the tree bottom-up with an explicit stack, so very deep trees cannot overflow the call stack
+    Expression* optimize(Expression* root) {
+        std::vector<Expression*> none;
+        return optimize(root, none);
+    }
+
+    // Same, and replaces each of nodes (subtrees of root) by the node it was optimized into
+    Expression* optimize(Expression* root, std::vector<Expression*>& nodes) {
+        struct Frame {
+            BinaryExpression* expression;
+            Expression* left; // Optimized left operand, null until it is done
+        };
+        std::unordered_map<const Expression*, Expression*> watched;
+        for (Expression* node : nodes) watched.emplace(node, node);
+        std::vector<Frame> stack;
+        Expression* next = root;      // Subtree to descend into, null while going back up
+        Expression* result = nullptr; // Optimized form of the subtree finished last
+        const Expression* original = nullptr; // Subtree result was optimized from
+        while (true) {
+            if (next) {
+                if (next->opcode() != OpCode::Number && next->opcode() != OpCode::Variable) {
+                    auto binary = static_cast<BinaryExpression*>(next);
+                    stack.push_back({binary, nullptr});
+                    next = binary->leftOperand();
+                    continue;
                 }
+                result = leaf(next);
+                original = next;
+                next = nullptr;
+            }
+            if (!watched.empty()) {
+                auto it = watched.find(original);
+                if (it != watched.end()) it->second = result;
+            }
+            if (stack.empty()) break;
+            Frame& frame = stack.back();
+            if (!frame.left) {
+                frame.left = result;
+                next = frame.expression->rightOperand();
+                continue;
+            }
+            OpCode op = frame.expression->opcode();
+            Expression* left = frame.left;
+            original = frame.expression;
+            stack.pop_back();
+            result = rewrite(op, left, result);
+        }
+        for (Expression*& node : nodes) node = watched[node];
+        return result;
+    }
+
+// Number of nodes in the expression, counting a shared subtree once when distinct is set
+    static size_t countNodes(const Expression* root, bool distinct) {
+        std::unordered_set<const Expression*> seen;
+        std::vector<const Expression*> pending{root};
+        size_t count = 0;
+        while (!pending.empty()) {
+            const Expression* e = pending.back();
+            pending.pop_back();
+            if (distinct && !seen.insert(e).second) continue;
+            count++;
+            if (e->opcode() != OpCode::Number && e->opcode() != OpCode::Variable) {
+                auto binary = static_cast<const BinaryExpression*>(e);
+                pending.push_back(binary->leftOperand());
+                pending.push_back(binary->rightOperand());
             }
         }
-        if (!number.empty()) {
-            tokens.push_back(number);
+        return count;
+    }
+};
+
+// Values of statements and of their larger parenthesized groups, reused when the same tokens are
+// evaluated again with the same variable values. The key hashes the tokens of the group together with
+// the current value of every variable it reads, so an assignment (or a direct write to
+// Context::variables) makes the old entries unreachable instead of stale; they age out of the LRU list.
+// Each entry also keeps the names and values it was computed from and a second, independent hash, and a
+// hit needs all of them to match. A hit skips parsing, optimizing and evaluating the group. Only groups
+// of at least minNodes tokens reading at most maxInputs variables are looked up; smaller ones are
+// cheaper to evaluate than to look up.
+class MemoCache {
+public:
+    struct Key {
+        uint64_t hash, check;
+        bool operator==(const Key& other) const { return hash == other.hash && check == other.check; }
+    };
+
+    // A lookup that missed, kept to insert the value once it has been computed
+    struct Probe {
+        Key key{0, 0};
+        std::vector<std::pair<std::string_view, double>> inputs; // Views into the input being evaluated
+    };
+
+    enum class Lookup : uint8_t { Skipped, Hit, Missed };
+
+    // A parenthesized group of the statement that was looked up
+    struct Group {
+        size_t open, close; // Token indices of its parentheses
+        Lookup lookup;
+        double value;               // On a hit
+        Probe probe;                // On a miss
+        Expression* node = nullptr; // On a miss, what the group parsed into
+    };
+
+    // Lookups for one statement: the statement as a whole and, when it missed, its groups in token order
+    struct Plan {
+        Lookup lookup = Lookup::Skipped;
+        double value = 0;
+        Probe probe;
+        std::vector<Group> groups;
+        size_t cursor = 0; // The parser reaches the groups in order
+
+        // The group whose '(' is token open, if it was looked up
+        Group* at(size_t open) {
+            while (cursor < groups.size() && groups[cursor].open < open) cursor++;
+            return cursor < groups.size() && groups[cursor].open == open ? &groups[cursor] : nullptr;
         }
-        return tokens;
+    };
+
+    struct Counters {
+        uint64_t hits = 0, misses = 0, insertions = 0, evictions = 0;
+    };
+
+    size_t capacity;           // Entries kept at most
+    size_t minNodes = 16;      // Smaller groups (in tokens) are not looked up
+    size_t maxInputs = 64;     // Groups reading more variables are not looked up
+    size_t maxNodes = 1 << 20; // Longer statements bypass the cache
+
+private:
+    static constexpr uint32_t NoInputs = 0, TooMany = UINT32_MAX; // Set ids
+    static constexpr uint64_t Prime = (uint64_t(1) << 61) - 1;   // Modulus of the rolling hash
+    static constexpr uint64_t Base = 0x1f3d5b79a2c4e687ULL % Prime, CheckBase = 0x9e3779b97f4a7c15ULL;
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const { return key.hash; }
+    };
+    struct Entry {
+        Key key;
+        std::vector<std::pair<std::string, double>> inputs;
+        double value;
+    };
+    struct Span {
+        size_t open, close;
+        uint32_t inputs;
+    };
+
+    std::list<Entry> entries; // Most recently used at the front
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+    Counters counts;
+    // Scratch for plan(): prefix hashes of the tokens and powers of the bases, so the hash of any range
+    // is a subtraction; and the sorted variable sets of the groups. Most groups read the same few
+    // variables as one of their parts, so they share its set instead of building their own.
+    std::vector<uint64_t> prefix, checkPrefix, powers, checkPowers;
+    std::vector<std::vector<std::string_view>> sets{{}};
+    std::unordered_map<std::string_view, uint32_t> singletons;
+    std::vector<Span> spans;
+
+    static uint64_t bitsOf(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof bits);
+        return bits;
+    }
+
+    static uint64_t mix(uint64_t h, uint64_t v) { // splitmix64 finalizer over h and v
+        uint64_t x = h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+        x ^= x >> 31;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
     }
 
-    Expression* buildExpressionTree(const std::vector<std::string>& tokens) {
-        std::stack<Expression*> values;
-        std::stack<char> operators;
-        
-        for (const std::string& token : tokens) {
-            if (std::isdigit(token[0]) || token.find('.') != std::string::npos) {
-                values.push(new NumberExpression(std::stod(token)));
-            } else if (std::isalpha(token[0])) {
-                values.push(new VariableExpression(token));
-            } else if (token == "(") {
-                operators.push('(');
-            } else if (token == ")") {
-                while (!operators.empty() && operators.top() != '(') {
-                    applyOperator(values, operators);
+    static uint64_t mulMod(uint64_t a, uint64_t b) {
+        __uint128_t product = static_cast<__uint128_t>(a) * b;
+        uint64_t r = (static_cast<uint64_t>(product) & Prime) + static_cast<uint64_t>(product >> 61);
+        return r >= Prime ? r - Prime : r;
+    }
+
+    static uint64_t nameHash(std::string_view name) { // FNV-1a
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (char c : name) h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+        return h;
+    }
+
+    // Numbers by value, so 2 and 2.0 are the same token
+    static uint64_t tokenValue(const Token& token) {
+        uint64_t payload = token.kind == TokenKind::Number ? bitsOf(token.number)
+                         : token.kind == TokenKind::Name ? nameHash(token.text) : static_cast<unsigned char>(token.text[0]);
+        return mix(static_cast<uint64_t>(token.kind), payload);
+    }
+
+    // Tokens [from, to) of the last plan(), as indices into the prefix arrays
+    Key rangeKey(size_t from, size_t to) const {
+        uint64_t hash = prefix[to] + Prime - mulMod(prefix[from], powers[to - from]);
+        uint64_t check = checkPrefix[to] - checkPrefix[from] * checkPowers[to - from];
+        return {mix(hash >= Prime ? hash - Prime : hash, to - from), mix(check, ~(to - from))};
+    }
+
+    uint32_t singleton(std::string_view name) {
+        if (maxInputs == 0) return TooMany;
+        auto [it, added] = singletons.emplace(name, uint32_t(sets.size()));
+        if (added) sets.push_back({name});
+        return it->second;
+    }
+
+    uint32_t merge(uint32_t a, uint32_t b) {
+        if (a == b || b == NoInputs) return a;
+        if (a == NoInputs) return b;
+        if (a == TooMany || b == TooMany) return TooMany;
+        const auto& left = sets[a];
+        const auto& right = sets[b];
+        if (std::includes(left.begin(), left.end(), right.begin(), right.end())) return a;
+        if (std::includes(right.begin(), right.end(), left.begin(), left.end())) return b;
+        std::vector<std::string_view> both;
+        std::set_union(left.begin(), left.end(), right.begin(), right.end(), std::back_inserter(both));
+        if (both.size() > maxInputs) return TooMany;
+        sets.push_back(std::move(both));
+        return sets.size() - 1;
+    }
+
+    // Looks up the key under the current values of the variables in set inputs. Skipped when the group
+    // reads too many variables or one that is undefined (evaluation reports it).
+    Lookup find(Key key, uint32_t inputs, const Context& context, Probe& probe, double& value) {
+        if (inputs == TooMany) return Lookup::Skipped;
+        probe.inputs.clear();
+        for (std::string_view name : sets[inputs]) {
+            auto it = context.variables.find(name);
+            if (it == context.variables.end()) return Lookup::Skipped;
+            key.hash = mix(key.hash, bitsOf(it->second));
+            key.check = mix(key.check ^ 0x2545f4914f6cdd1dULL, ~bitsOf(it->second));
+            probe.inputs.emplace_back(name, it->second);
+        }
+        probe.key = key;
+        auto it = index.find(key);
+        if (it != index.end() && sameInputs(*it->second, probe.inputs)) {
+            entries.splice(entries.begin(), entries, it->second); // Mark as most recently used
+            counts.hits++;
+            value = it->second->value;
+            return Lookup::Hit;
+        }
+        counts.misses++;
+        return Lookup::Missed;
+    }
+
+    static bool sameInputs(const Entry& entry, const std::vector<std::pair<std::string_view, double>>& inputs) {
+        if (entry.inputs.size() != inputs.size()) return false;
+        for (size_t i = 0; i < inputs.size(); i++) {
+            if (entry.inputs[i].first != inputs[i].first || bitsOf(entry.inputs[i].second) != bitsOf(inputs[i].second)) return false;
+        }
+        return true;
+    }
+
+public:
+    explicit MemoCache(size_t capacity = 4096) : capacity(capacity) {}
+
+    // Looks up the statement in tokens [begin, end) and, when it misses, each group of at least minNodes
+    // tokens in it, outermost first; the groups inside a hit are not looked up. Statements whose
+    // parentheses do not balance are left to the parser to report.
+    void plan(const std::vector<Token>& tokens, size_t begin, size_t end, const Context& context, Plan& out) {
+        out.lookup = Lookup::Skipped;
+        out.groups.clear();
+        out.cursor = 0;
+        size_t length = end - begin;
+        if (capacity == 0 || length < minNodes || length > maxNodes) return;
+        prefix.resize(length + 1);
+        checkPrefix.resize(length + 1);
+        powers.resize(length + 1);
+        checkPowers.resize(length + 1);
+        prefix[0] = checkPrefix[0] = 0;
+        powers[0] = checkPowers[0] = 1;
+        sets.resize(1);
+        singletons.clear();
+        spans.clear();
+        std::vector<size_t> open;        // Spans whose ')' has not come yet
+        uint32_t statementInputs = NoInputs;
+        for (size_t i = 0; i < length; i++) {
+            const Token& token = tokens[begin + i];
+            uint64_t v = tokenValue(token);
+            prefix[i + 1] = mulMod(prefix[i], Base) + v % Prime;
+            if (prefix[i + 1] >= Prime) prefix[i + 1] -= Prime;
+            powers[i + 1] = mulMod(powers[i], Base);
+            checkPrefix[i + 1] = checkPrefix[i] * CheckBase + (v ^ (v >> 29));
+            checkPowers[i + 1] = checkPowers[i] * CheckBase;
+            uint32_t& inputs = open.empty() ? statementInputs : spans[open.back()].inputs;
+            if (token.kind == TokenKind::Name) {
+                if (inputs == TooMany || std::binary_search(sets[inputs].begin(), sets[inputs].end(), token.text)) continue;
+                inputs = merge(inputs, singleton(token.text));
+            } else if (token.kind == TokenKind::LeftParen) {
+                spans.push_back({i, 0, NoInputs});
+                open.push_back(spans.size() - 1);
+            } else if (token.kind == TokenKind::RightParen) {
+                if (open.empty()) return;
+                Span& closed = spans[open.back()];
+                closed.close = i;
+                open.pop_back();
+                uint32_t& outer = open.empty() ? statementInputs : spans[open.back()].inputs;
+                outer = merge(outer, closed.inputs);
+            }
+        }
+        if (!open.empty()) return;
+
+        out.lookup = find(rangeKey(0, length), statementInputs, context, out.probe, out.value);
+        if (out.lookup == Lookup::Hit) return;
+        size_t covered = 0; // Groups before this token are inside a hit
+        for (const Span& span : spans) {
+            if (span.open < covered || span.close + 1 - span.open < minNodes) continue;
+            Group group{begin + span.open, begin + span.close, Lookup::Skipped, 0, {}, nullptr};
+            group.lookup = find(rangeKey(span.open, span.close + 1), span.inputs, context, group.probe, group.value);
+            if (group.lookup == Lookup::Skipped) continue;
+            if (group.lookup == Lookup::Hit) covered = span.close;
+            out.groups.push_back(std::move(group));
+        }
+    }
+
+    // Remembers the value computed for a probe that missed
+    void insert(const Probe& probe, double value) {
+        auto it = index.find(probe.key);
+        if (it == index.end()) {
+            entries.push_front(Entry{probe.key, {}, value});
+            it = index.emplace(probe.key, entries.begin()).first;
+            counts.insertions++;
+        } else { // A colliding entry: the newer value takes its place
+            entries.splice(entries.begin(), entries, it->second);
+            it->second->value = value;
+        }
+        it->second->inputs.assign(probe.inputs.begin(), probe.inputs.end());
+        if (entries.size() > capacity) {
+            index.erase(entries.back().key);
+            entries.pop_back(); // Evict the least recently used value
+            counts.evictions++;
+        }
+    }
+
+    void clear() {
+        entries.clear();
+        index.clear();
+    }
+
+    size_t size() const { return entries.size(); }
+    const Counters& counters() const { return counts; }
+};
+
+// Interpreter
+class Interpreter {
+private:
+    Context* context;
+    ExpressionArena arena; // Owns the nodes of the tree being evaluated
+    std::vector<Token> tokens; // Reused token buffer
+    OptimizationStats lastStats; // Node counts of the most recent expression
+    MemoCache::Plan memoPlan; // Memo lookups of the statement being run, reused
+
+    // Binding power of each binary operator, known at compile time; higher binds tighter, equal powers go left to right
+    static constexpr int bindingPower(char op) {
+        return op == '+' || op == '-' ? 10 : op == '*' || op == '/' || op == '%' ? 20 : 0;
+    }
+    static constexpr int UnaryPower = 30; // Unary minus binds tighter than any binary operator
+
+    // Pratt parser: a single left-to-right pass over the tokens, building each node as soon as its operands exist
+    template <typename Allocator>
+    struct Parser {
+        const std::vector<Token>& tokens;
+        Allocator& allocator;
+        size_t next = 0; // Index of the next unread token
+        MemoCache::Plan* memo = nullptr; // Groups with a memoized value, parsed as that number
+
+        bool at(TokenKind kind) const { return next < tokens.size() && tokens[next].kind == kind; }
+
+        [[noreturn]] void unexpected() const {
+            if (next == tokens.size()) throw std::runtime_error("Unexpected end of input");
+            if (tokens[next].kind == TokenKind::MalformedNumber) throw std::runtime_error("Invalid number: " + std::string(tokens[next].text));
+            throw std::runtime_error("Unexpected '" + std::string(tokens[next].text) + "'");
+        }
+
+        // What an operand or operator is waiting for while the expression to its right is parsed
+        struct Frame {
+            enum Kind : uint8_t { Operator, Group, Plus, Minus } kind;
+            int minPower;              // Of the expression the frame belongs to, restored when it completes
+            Expression* left = nullptr; // Operator: its left operand
+            char op = 0;                // Operator: which one
+            MemoCache::Group* group = nullptr;
+        };
+
+        // An operand followed by every operator that binds tighter than minPower. Parentheses, unary
+        // signs and right operands go on an explicit stack instead of recursing, so nesting hundreds of
+        // thousands of levels deep needs heap memory, not call stack.
+        Expression* expression(int minPower) {
+            std::vector<Frame> stack;
+            int power = minPower; // Binding power of the expression being parsed now
+            while (true) {
+                Expression* value = operand(stack, power);
+                if (!value) continue; // A prefix was pushed, its operand comes next
+                while (true) {
+                    if (at(TokenKind::Operator) && bindingPower(tokens[next].text[0]) > power) {
+                        char op = tokens[next++].text[0];
+                        stack.push_back({Frame::Operator, power, value, op});
+                        power = bindingPower(op);
+                        break;
+                    }
+                    if (stack.empty()) return value;
+                    Frame frame = stack.back();
+                    stack.pop_back();
+                    power = frame.minPower;
+                    value = complete(frame, value);
                 }
-                operators.pop();
-            } else if (token == "+" || token == "-" || token == "*" || token == "/" || token == "%") {
-                while (!operators.empty() && operators.top() != '(' && precedence[operators.top()] >= precedence[token[0]]) {
-                    applyOperator(values, operators);
+            }
+        }
+
+        // A number or variable; or, for '(' and unary signs, pushes a frame, starts the expression
+        // inside and returns null
+        Expression* operand(std::vector<Frame>& stack, int& power) {
+            if (next == tokens.size()) unexpected();
+            const Token& token = tokens[next];
+            switch (token.kind) {
+                case TokenKind::Number:
+                    next++;
+                    return allocator.template create<NumberExpression>(token.number);
+                case TokenKind::Name:
+                    next++;
+                    return allocator.template create<VariableExpression>(allocator.copyString(token.text));
+                case TokenKind::LeftParen: {
+                    MemoCache::Group* group = memo ? memo->at(next) : nullptr;
+                    if (group && group->lookup == MemoCache::Lookup::Hit) {
+                        next = group->close + 1;
+                        return allocator.template create<NumberExpression>(group->value);
+                    }
+                    next++;
+                    stack.push_back({Frame::Group, power, nullptr, 0, group});
+                    power = 0;
+                    return nullptr;
                 }
-                operators.push(token[0]);
+                case TokenKind::Operator:
+                    if (token.text[0] == '+' || token.text[0] == '-') {
+                        next++;
+                        stack.push_back({token.text[0] == '+' ? Frame::Plus : Frame::Minus, power});
+                        power = UnaryPower;
+                        return nullptr;
+                    }
+                    unexpected();
+                default:
+                    unexpected();
+            }
+        }
+
+        // Finishes what frame was waiting for, now that the expression to its right is value
+        Expression* complete(const Frame& frame, Expression* value) {
+            switch (frame.kind) {
+                case Frame::Operator:
+                    switch (frame.op) {
+                        case '+': return allocator.template create<AdditionExpression>(frame.left, value);
+                        case '-': return allocator.template create<SubtractionExpression>(frame.left, value);
+                        case '*': return allocator.template create<MultiplicationExpression>(frame.left, value);
+                        case '/': return allocator.template create<DivisionExpression>(frame.left, value);
+                        default: return allocator.template create<ModuloExpression>(frame.left, value);
+                    }
+                case Frame::Group:
+                    if (!at(TokenKind::RightParen)) {
+                        if (next == tokens.size()) throw std::runtime_error("Missing ')'");
+                        unexpected();
+                    }
+                    next++;
+                    if (frame.group) frame.group->node = value;
+                    return value;
+                case Frame::Plus:
+                    return value;
+                case Frame::Minus:
+                    if (value->opcode() == OpCode::Number) {
+                        return allocator.template create<NumberExpression>(-static_cast<NumberExpression*>(value)->value());
+                    }
+                    // -x is exactly -1 * x, so no separate negation node is needed
+                    return allocator.template create<MultiplicationExpression>(allocator.template create<NumberExpression>(-1.0), value);
             }
+            return value;
         }
-        
-        while (!operators.empty()) {
-            applyOperator(values, operators);
+    };
+
+    // Optimizes, flattens and evaluates one parsed expression; large ones fork their independent subtrees.
+    // With a memo plan, the groups that missed are remembered once the whole expression has a value.
+    double run(Expression* tree, const Context& variables, MemoCache::Plan* plan = nullptr) {
+        lastStats.nodesBefore = ExpressionOptimizer::countNodes(tree, false);
+        std::vector<Expression*> parts; // Parsed, then optimized, forms of the groups that missed
+        if (plan) {
+            for (const MemoCache::Group& group : plan->groups) {
+                if (group.lookup == MemoCache::Lookup::Missed && group.node) parts.push_back(group.node);
+            }
         }
-        return values.top();
+        tree = ExpressionOptimizer(arena).optimize(tree, parts);
+        lastStats.nodesAfter = ExpressionOptimizer::countNodes(tree, true);
+        ForkOptions options = forkOptions;
+        if (lastStats.nodesAfter < options.threshold) options.maxTasks = 1; // Evaluates on this thread
+        FlatExpression flat(tree, options);
+        double value = flat.interpret(variables);
+        if (!parts.empty()) {
+            size_t next = 0;
+            for (const MemoCache::Group& group : plan->groups) {
+                if (group.lookup != MemoCache::Lookup::Missed || !group.node) continue;
+                double part;
+                if (flat.valueOf(parts[next++], part)) memo->insert(group.probe, part);
+            }
+        }
+        return value;
     }
 
-    void applyOperator(std::stack<Expression*>& values, std::stack<char>& operators) {
-        char op = operators.top(); operators.pop();
-        Expression* right = values.top(); values.pop();
-        Expression* left = values.top(); values.pop();
-        
-        switch (op) {
-            case '+': values.push(new AdditionExpression(left, right)); break;
-            case '-': values.push(new SubtractionExpression(left, right)); break;
-            case '*': values.push(new MultiplicationExpression(left, right)); break;
-            case '/': values.push(new DivisionExpression(left, right)); break;
-            case '%': values.push(new ModuloExpression(left,right)); break;
+    // Parses and runs the statement at the parser's position: the whole input when whole is set, else
+    // up to the next comma. With a memo, a statement seen before with the same variable values is not
+    // parsed at all, and its large groups seen before are parsed as their values.
+    double runStatement(Parser<ExpressionArena>& parser, bool whole, const Context& variables) {
+        if (!memo) {
+            Expression* tree = parser.expression(0);
+            if (whole && parser.next != tokens.size()) parser.unexpected();
+            return run(tree, variables);
         }
+        size_t end = parser.next;
+        while (end < tokens.size() && (whole || tokens[end].kind != TokenKind::Comma)) end++;
+        memo->plan(tokens, parser.next, end, variables, memoPlan);
+        if (memoPlan.lookup == MemoCache::Lookup::Hit) {
+            parser.next = end;
+            lastStats = {1, 1}; // Not parsed: counted as the constant it evaluated to
+            return memoPlan.value;
+        }
+        parser.memo = &memoPlan;
+        Expression* tree = parser.expression(0);
+        parser.memo = nullptr;
+        if (whole && parser.next != tokens.size()) parser.unexpected();
+        double value = run(tree, variables, &memoPlan);
+        if (memoPlan.lookup == MemoCache::Lookup::Missed && parser.next == end) memo->insert(memoPlan.probe, value);
+        return value;
     }
 
-    void trim(std::string& str) {
-        str.erase(0, str.find_first_not_of(" "));
-        str.erase(str.find_last_not_of(" ") + 1);
+public:
+    ForkOptions forkOptions; // When evaluation spreads a single expression over several threads
+    MemoCache* memo = nullptr; // When set, values of repeated statements and groups are reused
+
+    Interpreter(Context* context) : context(context) {}
+
+    // Runs comma-separated statements ("a=5,b=7,a/b") in one pass over the tokens and returns the last value
+    double interpret(std::string_view input) {
+        arena.reset(); // Releases the previous trees in one step
+        tokenize(input, tokens);
+        Parser<ExpressionArena> parser{tokens, arena};
+        double value = 0;
+        do {
+            std::string_view target;
+            if (parser.at(TokenKind::Name) && parser.next + 1 < tokens.size() && tokens[parser.next + 1].kind == TokenKind::Assign) {
+                target = tokens[parser.next].text;
+                parser.next += 2;
+            }
+            value = runStatement(parser, false, *context);
+            if (!target.empty()) context->variables[std::string(target)] = value;
+        } while (parser.at(TokenKind::Comma) && ++parser.next);
+        if (parser.next != tokens.size()) parser.unexpected();
+        return value;
+    }
+
+    // Parses, optimizes, flattens and evaluates one expression
+    double evaluate(std::string_view expression) { return evaluate(expression, *context); }
+
+    // Same, reading the variables from another context, which is left untouched
+    double evaluate(std::string_view expression, const Context& variables) {
+        arena.reset();
+        tokenize(expression, tokens);
+        Parser<ExpressionArena> parser{tokens, arena};
+        return runStatement(parser, true, variables);
     }
+
+    // Node-count reduction achieved on the last evaluated expression
+    const OptimizationStats& lastOptimization() const { return lastStats; }
+
+    // Splits input into number/name words, operators and parentheses, views into input reused through out
+    void tokenize(std::string_view input, std::vector<Token>& out) {
+        out.clear();
+        size_t i = 0;
+        while (i < input.size()) {
+            char c = input[i];
+            if (std::isalnum(static_cast<unsigned char>(c)) || c == '.') {
+                size_t start = i;
+                while (i < input.size() && (std::isalnum(static_cast<unsigned char>(input[i])) || input[i] == '.')) i++;
+                std::string_view word = input.substr(start, i - start);
+                if (std::isdigit(static_cast<unsigned char>(word[0])) || word.find('.') != std::string_view::npos) {
+                    double value = 0;
+                    auto parsed = std::from_chars(word.data(), word.data() + word.size(), value);
+                    bool whole = parsed.ec == std::errc() && parsed.ptr == word.data() + word.size();
+                    out.push_back({whole ? TokenKind::Number : TokenKind::MalformedNumber, word, value});
+                } else {
+                    out.push_back({TokenKind::Name, word, 0});
+                }
+                continue;
+            }
+            if (c == '+' || c == '-' || c == '*' || c == '/' || c == '%') {
+                out.push_back({TokenKind::Operator, input.substr(i, 1), 0});
+            } else if (c == '(') {
+                out.push_back({TokenKind::LeftParen, input.substr(i, 1), 0});
+            } else if (c == ')') {
+                out.push_back({TokenKind::RightParen, input.substr(i, 1), 0});
+            } else if (c == ',') {
+                out.push_back({TokenKind::Comma, input.substr(i, 1), 0});
+            } else if (c == '=') {
+                out.push_back({TokenKind::Assign, input.substr(i, 1), 0});
+            }
+            i++;
+        }
+    }
+
+    // Parses the whole token stream as one expression
+    template <typename Allocator>
+    Expression* buildExpressionTree(const std::vector<Token>& tokens, Allocator& allocator) {
+        Parser<Allocator> parser{tokens, allocator};
+        Expression* tree = parser.expression(0);
+        if (parser.next != tokens.size()) parser.unexpected();
+        return tree;
+    }
+};
+
+// Variables shared by threads that evaluate expressions while assignments update them. An assignment
+// copies the current variables, runs on the copy and publishes it whole (see epoch.h); a Reader
+// evaluates against the copy that was current when it started, so it never locks and never sees an
+// input half applied.
+class SharedContext {
+private:
+    std::mutex writeLock; // Assignments run one at a time
+    epoch::Versioned<Context> published{std::make_unique<Context>()};
+
+public:
+    // Runs input ("a=5,b=7") and publishes the result. An input that throws publishes nothing.
+    double assign(std::string_view input) {
+        std::lock_guard<std::mutex> guard(writeLock);
+        auto next = std::make_unique<Context>(published.latest());
+        double value = Interpreter(next.get()).interpret(input);
+        published.publish(std::move(next));
+        return value;
+    }
+
+    // One per evaluating thread
+    class Reader {
+    private:
+        epoch::Versioned<Context>::Reader pin;
+        Interpreter interpreter{nullptr}; // Only evaluates against pinned versions
+
+    public:
+        explicit Reader(SharedContext& shared) : pin(shared.published) {}
+
+        double evaluate(std::string_view expression) {
+            auto version = pin.read();
+            return interpreter.evaluate(expression, *version);
+        }
+    };
 };
 
-int main() {
+// Builds and releases the same token stream repeatedly, returning nanoseconds per tree
+template <typename Allocator>
+double timeTreeBuilds(Interpreter& interpreter, const std::vector<Token>& tokens, int rounds) {
+    Allocator allocator;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        interpreter.buildExpressionTree(tokens, allocator);
+        allocator.reset();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / rounds;
+}
+
+// Compares one new per node against the arena on deep and wide expressions
+void runArenaBenchmark() {
+    Context context;
+    Interpreter interpreter(&context);
+    std::string deep, wide;
+    for (int i = 0; i < 500; i++) deep += "(x+";
+    deep += "1";
+    for (int i = 0; i < 500; i++) deep += ")*2";
+    for (int i = 0; i < 2000; i++) wide += (i ? "+" : "") + std::string(i % 2 ? "x" : "3.5") + "*y";
+
+    struct Workload { const char* name; std::string text; };
+    for (const Workload& w : {Workload{"deep", deep}, Workload{"wide", wide}}) {
+        std::vector<Token> tokens;
+        interpreter.tokenize(w.text, tokens);
+        int rounds = 2000;
+        double heap = timeTreeBuilds<HeapAllocator>(interpreter, tokens, rounds);
+        double arena = timeTreeBuilds<ExpressionArena>(interpreter, tokens, rounds);
+        std::cout << w.name << " (" << tokens.size() << " tokens): new/delete " << heap << " ns/tree, arena "
+                  << arena << " ns/tree, speedup " << heap / arena << "x\n";
+    }
+}
+
+// Evaluates one tree many times through virtual interpret and through the flat array
+void runDispatchBenchmark() {
+    Context context;
+    context.variables["x"] = 1.5;
+    context.variables["y"] = 0.25;
+    Interpreter interpreter(&context);
+    std::string balanced = "x";
+    for (int i = 0; i < 9; i++) balanced = "(" + balanced + (i % 2 ? "*y+" : "-x*") + balanced + ")";
+    std::string chain;
+    for (int i = 0; i < 500; i++) chain += (i ? "+" : "") + std::string(i % 3 ? "x*y" : "x/2");
+
+    struct Workload { const char* name; std::string text; };
+    for (const Workload& w : {Workload{"balanced", balanced}, Workload{"chain", chain}}) {
+        ExpressionArena arena;
+        std::vector<Token> tokens;
+        interpreter.tokenize(w.text, tokens);
+        Expression* tree = interpreter.buildExpressionTree(tokens, arena);
+        FlatExpression flat(tree);
+        const int rounds = 5000;
+        volatile double sink = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) sink = sink + tree->interpret(context);
+        auto middle = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) sink = sink + flat.interpret(context);
+        auto end = std::chrono::steady_clock::now();
+        double tree_ns = std::chrono::duration<double, std::nano>(middle - start).count() / rounds;
+        double flat_ns = std::chrono::duration<double, std::nano>(end - middle).count() / rounds;
+        std::cout << w.name << " (" << flat.size() << " nodes): virtual " << tree_ns << " ns/eval, flat "
+                  << flat_ns << " ns/eval, speedup " << tree_ns / flat_ns << "x\n";
+    }
+}
+
+// Node counts and evaluation time with and without the optimization pass
+void runOptimizerBenchmark() {
+    Context context;
+    context.variables["r"] = 2.5;
+    context.variables["x"] = 4;
+    context.variables["y"] = 0.5;
+    Interpreter interpreter(&context);
+    for (std::string text : {"2*3.14159*r", "(10+5)/3*x", "x*1+y*2-0", "(x+y)*(x+y)/(x+y)", "r/4+r/3+(1+2)*(3+4)*r"}) {
+        ExpressionArena arena;
+        std::vector<Token> tokens;
+        interpreter.tokenize(text, tokens);
+        Expression* tree = interpreter.buildExpressionTree(tokens, arena);
+        FlatExpression plain(tree);
+        Expression* optimized = ExpressionOptimizer(arena).optimize(tree);
+        FlatExpression flat(optimized);
+        const int rounds = 200000;
+        volatile double sink = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) sink = sink + plain.interpret(context);
+        auto middle = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) sink = sink + flat.interpret(context);
+        auto end = std::chrono::steady_clock::now();
+        std::cout << text << ": nodes " << ExpressionOptimizer::countNodes(tree, false) << " -> "
+                  << ExpressionOptimizer::countNodes(optimized, true) << ", "
+                  << std::chrono::duration<double, std::nano>(middle - start).count() / rounds << " -> "
+                  << std::chrono::duration<double, std::nano>(end - middle).count() / rounds << " ns/eval\n";
+    }
+}
+
+// Evaluates one large balanced expression on the calling thread and with forked subtrees,
+// and a chain and a nesting deep enough to have overflowed the recursive passes
+void runForkBenchmark() {
+    Context context;
+    context.variables["x"] = 0.5;
+    context.variables["y"] = 3;
+    Interpreter interpreter(&context);
+    std::vector<std::string> level;
+    for (int i = 0; i < (1 << 17); i++) level.push_back((i % 2 ? "y*" : "x*") + std::to_string(i + 3));
+    while (level.size() > 1) { // Pair neighbours until one balanced expression is left
+        std::vector<std::string> up;
+        for (size_t i = 0; i < level.size(); i += 2) up.push_back("(" + level[i] + (i % 4 ? "-" : "+") + level[i + 1] + ")");
+        level.swap(up);
+    }
+    ExpressionArena arena;
+    std::vector<Token> tokens;
+    interpreter.tokenize(level[0], tokens);
+    Expression* tree = ExpressionOptimizer(arena).optimize(interpreter.buildExpressionTree(tokens, arena));
+    ForkOptions forked;
+    forked.maxTasks = std::max(4u, forked.maxTasks);
+    FlatExpression serial(tree), parallel(tree, forked);
+    const int rounds = 50;
+    volatile double sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) sink = sink + serial.interpret(context);
+    auto middle = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) sink = sink + parallel.interpret(context);
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "balanced (" << serial.size() << " nodes): one thread "
+              << std::chrono::duration<double, std::micro>(middle - start).count() / rounds << " us/eval, "
+              << parallel.tasks() << " tasks on " << std::thread::hardware_concurrency() << " cores "
+              << std::chrono::duration<double, std::micro>(end - middle).count() / rounds << " us/eval, results "
+              << (serial.interpret(context) == parallel.interpret(context) ? "match" : "DIFFER") << "\n";
+
+    std::string chain = "x";
+    for (int i = 0; i < 300000; i++) chain += (i % 2 ? "+y*" : "-x*") + std::to_string(i % 1000 + 3);
+    start = std::chrono::steady_clock::now();
+    double value = interpreter.evaluate(chain);
+    std::cout << "chain (" << interpreter.lastOptimization().nodesBefore << " nodes deep-left): " << value << " in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+
+    // Right-nested parentheses, far deeper than a recursive parser's call stack allows: 1+(1+(...)) is levels+1
+    const int levels = 300000;
+    std::string nested;
+    for (int i = 0; i < levels; i++) nested += "1+(";
+    nested += "1" + std::string(levels, ')');
+    start = std::chrono::steady_clock::now();
+    value = interpreter.evaluate(nested);
+    std::cout << "nested (" << levels << " levels of parentheses): " << value << " in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms"
+              << (value == levels + 1 ? "" : " (WRONG)") << "\n";
+}
+
+// Readers evaluating "a + b" while a writer keeps assigning "a = k, b = -k", through a SharedContext and
+// through one interpreter behind a mutex. A nonzero sum would be a reader seeing half an assignment.
+void runSharedBenchmark() {
+    const unsigned readers = std::max(2u, std::thread::hardware_concurrency());
+    const auto duration = std::chrono::milliseconds(300);
+    auto measure = [&](auto evaluate, auto assign, uint64_t& torn) {
+        std::atomic<bool> stop{false};
+        std::atomic<uint64_t> evaluations{0}, tornReads{0};
+        std::vector<std::thread> threads;
+        for (unsigned r = 0; r < readers; r++) {
+            threads.emplace_back([&] {
+                auto state = evaluate.prepare();
+                uint64_t count = 0, bad = 0;
+                for (; !stop.load(std::memory_order_relaxed); count++) bad += evaluate(state, "a + b") != 0;
+                evaluations += count;
+                tornReads += bad;
+            });
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t k = 1; std::chrono::steady_clock::now() - start < duration; k++) {
+            assign("a = " + std::to_string(k) + ", b = -" + std::to_string(k));
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        stop = true;
+        for (std::thread& thread : threads) thread.join();
+        torn = tornReads;
+        return evaluations / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    SharedContext shared;
+    shared.assign("a = 0, b = 0");
+    struct SharedEvaluate {
+        SharedContext* shared;
+        std::unique_ptr<SharedContext::Reader> prepare() const { return std::make_unique<SharedContext::Reader>(*shared); }
+        double operator()(std::unique_ptr<SharedContext::Reader>& reader, const char* input) const { return reader->evaluate(input); }
+    };
+    uint64_t sharedTorn = 0;
+    double sharedRate = measure(SharedEvaluate{&shared}, [&](const std::string& input) { shared.assign(input); }, sharedTorn);
+
+    Context context;
+    Interpreter interpreter(&context);
+    std::mutex lock;
+    interpreter.interpret("a = 0, b = 0");
+    struct LockedEvaluate {
+        Interpreter* interpreter;
+        std::mutex* lock;
+        int prepare() const { return 0; }
+        double operator()(int, const char* input) const {
+            std::lock_guard<std::mutex> guard(*lock);
+            return interpreter->evaluate(input);
+        }
+    };
+    uint64_t lockedTorn = 0;
+    double lockedRate = measure(LockedEvaluate{&interpreter, &lock}, [&](const std::string& input) {
+        std::lock_guard<std::mutex> guard(lock);
+        interpreter.interpret(input);
+    }, lockedTorn);
+    std::cout << "shared context, " << readers << " readers: " << sharedRate << " evals/s, torn reads " << sharedTorn
+              << "; interpreter behind a mutex: " << lockedRate << " evals/s, torn reads " << lockedTorn << "\n";
+}
+
+// Queries repeated with unchanged variables, and queries that share one large subexpression while a
+// small variable changes every time, each evaluated with and without a memo cache
+void runMemoBenchmark() {
+    std::string polynomial; // 400 terms over x and y
+    for (int i = 0; i < 400; i++) polynomial += (i ? "+" : "") + std::to_string(i % 7 + 1) + "*x*y/" + std::to_string(i % 5 + 2) + "-y";
+    std::vector<std::string> repeated;
+    for (int k = 1; k <= 8; k++) repeated.push_back("(" + polynomial + ")*" + std::to_string(k) + "+x");
+    std::vector<std::string> shared;
+    for (int i = 0; i < 1000; i++) shared.push_back("t = " + std::to_string(i) + ", (" + polynomial + ")*t + t/3");
+
+    struct Workload { const char* name; const std::vector<std::string>* queries; int rounds; };
+    for (const Workload& w : {Workload{"repeated", &repeated, 500}, Workload{"shared subexpression", &shared, 4}}) {
+        double elapsed[2], sums[2];
+        MemoCache memo;
+        for (int withMemo = 0; withMemo < 2; withMemo++) {
+            Context context;
+            context.variables["x"] = 1.25;
+            context.variables["y"] = -0.5;
+            Interpreter interpreter(&context);
+            if (withMemo) interpreter.memo = &memo;
+            sums[withMemo] = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int round = 0; round < w.rounds; round++) {
+                for (const std::string& query : *w.queries) sums[withMemo] += interpreter.interpret(query);
+            }
+            elapsed[withMemo] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count()
+                                / (w.rounds * w.queries->size());
+        }
+        const MemoCache::Counters& counts = memo.counters();
+        std::cout << w.name << " (" << w.queries->size() << " queries x " << w.rounds << "): " << elapsed[0]
+                  << " us/query, memoized " << elapsed[1] << " us/query (hits " << counts.hits << ", misses "
+                  << counts.misses << ", evictions " << counts.evictions << "), results "
+                  << (sums[0] == sums[1] ? "match" : "DIFFER") << "\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        runArenaBenchmark();
+        runDispatchBenchmark();
+        runOptimizerBenchmark();
+        runForkBenchmark();
+        runSharedBenchmark();
+        runMemoBenchmark();
+        return 0;
+    }
+    binlog::Options logOptions;
+    std::unique_ptr<MemoCache> memo; // --memo[=ENTRIES]
+    for (int i = 1; i < argc; i++) {
+        std::string_view option = argv[i];
+        if (option == "--memo" || option.substr(0, 7) == "--memo=") {
+            size_t entries = 4096;
+            if (option.size() > 7) {
+                auto parsed = std::from_chars(option.data() + 7, option.data() + option.size(), entries);
+                if (parsed.ec != std::errc() || parsed.ptr != option.data() + option.size()) {
+                    std::cerr << "Invalid memo size " << argv[i] << "\n";
+                    return 1;
+                }
+            }
+            memo = std::make_unique<MemoCache>(entries);
+            continue;
+        }
+        if (!binlog::parseOption(argv[i], logOptions)) {
+            std::cerr << "Unknown option " << argv[i] << "\n";
+            return 1;
+        }
+    }
     std::string input;
     Context context;
     Interpreter interpreter(&context);
-    std::ofstream logFile("calculation_log.txt", std::ios::app); // Open file in append mode
+    interpreter.memo = memo.get();
+    // Appended to by a background thread; log_decoder prints it in the old calculation_log.txt layout
+    binlog::AsyncWriter logFile("calculation_log.bin", binlog::Style::Calculation, logOptions);
 
-    std::cout<< std::setw(15) <<std::setfill('*') << "*"<<std::endl;
-    std::cout << "Hello!! \nWelcome!"<<std::endl;
+    std::cout<< std::setw(15) <<std::setfill('*') << "*"<<"\n";
+    std::cout << "Hello!! \nWelcome!\n";
 
     while (true) {
-        std::cout << "Enter expression: ";
-        std::getline(std::cin, input);
+        std::cout << "Enter expression: "; // Flushed by std::cin, which is tied to std::cout
+        if (!std::getline(std::cin, input)) break;
         if (input == "0" || input == "end" || input == "End" || input == "END") break;
 
         try {
             double result = interpreter.interpret(input);
-            std::cout << "Result: " << result << std::endl;
-            logFile << "Expression: " << input << " = " << result << std::endl;
+            std::cout << "Result: " << result << "\n";
+            logFile.value(input, result);
         } catch (const std::exception& e) {
-            std::cout << "Error: " << e.what() << std::endl;
-            logFile << "Expression: " << input << " | Error: " << e.what() << std::endl;
+            std::cout << "Error: " << e.what() << "\n";
+            logFile.error(input, e.what());
         }
     }
 
-    logFile.close();
-    std::cout << "Thank You!!"<< std::endl;
+    if (memo) {
+        const MemoCache::Counters& counts = memo->counters();
+        std::cout << "Memo: hits " << counts.hits << ", misses " << counts.misses << ", entries " << memo->size()
+                  << ", evictions " << counts.evictions << "\n";
+    }
+    std::cout << "Thank You!!\n";
     std::cout<< std::setw(15) <<std::setfill('*') << "*"<<std::endl;
-    return 0;
+    return 0; // logFile drains its queue and closes the file
 }
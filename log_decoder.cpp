@@ -0,0 +1,130 @@
+// Prints binary history/audit logs (see binary_log.h) as the text logs the calculators used to write.
+// Usage: log_decoder [-t] [--precision=N | --shortest] <log file>...
+//     -t prefixes every entry with its UTC time. Values print in the shortest form that reads back as
+//     the logged double, or with N digits after the point as final_submission's --precision=N prints them.
+#include <charconv>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <ctime>
+#include "binary_log.h"
+
+// "2024-05-01 12:00:00.123456" for a time in microseconds since the epoch
+std::string formatTime(int64_t micros) {
+    std::time_t seconds = std::time_t(micros / 1000000);
+    std::tm utc{};
+#if defined(_WIN32)
+    gmtime_s(&utc, &seconds);
+#else
+    gmtime_r(&seconds, &utc);
+#endif
+    std::ostringstream stream;
+    stream << std::put_time(&utc, "%Y-%m-%d %H:%M:%S") << '.' << std::setw(6) << std::setfill('0') << micros % 1000000;
+    return stream.str();
+}
+
+// How Value records are printed, as final_submission's NumberFormat
+struct NumberFormat {
+    bool fixed = false; // precision digits after the point rather than the shortest round-trip form
+    int precision = 2;
+
+    // Reads --precision=N (0 to 17) or --shortest; false if arg is neither
+    bool parseOption(const std::string& arg) {
+        if (arg == "--shortest") {
+            fixed = false;
+            return true;
+        }
+        if (arg.compare(0, 12, "--precision=") != 0) return false;
+        int digits = 0;
+        const char* end = arg.data() + arg.size();
+        auto parsed = std::from_chars(arg.data() + 12, end, digits);
+        if (parsed.ec != std::errc() || parsed.ptr != end || digits < 0 || digits > 17) return false;
+        fixed = true;
+        precision = digits;
+        return true;
+    }
+
+    std::string print(double value) const {
+        char buffer[400]; // Fixed notation of numbers near DBL_MAX
+        std::to_chars_result written = fixed
+            ? std::to_chars(buffer, buffer + sizeof buffer, value, std::chars_format::fixed, precision)
+            : std::to_chars(buffer, buffer + sizeof buffer, value);
+        return std::string(buffer, written.ptr);
+    }
+};
+
+// Writes one record in the layout of history_final.txt or calculation_log.txt
+void printRecord(std::ostream& out, binlog::Style style, const binlog::Record& record, const NumberFormat& format) {
+    using binlog::Tag;
+    if (record.tag == Tag::Dropped) {
+        out << "# " << record.count << " records dropped\n";
+        return;
+    }
+    std::ostringstream result;
+    if (style == binlog::Style::History) {
+        if (record.tag == Tag::Value) result << format.print(record.value);
+        if (record.tag == Tag::Error) result << "Error: " << record.text;
+        if (record.tag == Tag::Text) result << record.text;
+        out << "Input: " << record.input << "\nResult: " << result.str() << "\n";
+    } else {
+        out << "Expression: " << record.input;
+        if (record.tag == Tag::Value) out << " = " << format.print(record.value);
+        if (record.tag == Tag::Error) out << " | Error: " << record.text;
+        if (record.tag == Tag::Text) out << " = " << record.text;
+        out << "\n";
+    }
+}
+
+int decodeFile(const std::string& path, bool timestamps, const NumberFormat& format) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Cannot open " << path << "\n";
+        return 1;
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    std::string data = contents.str();
+    const char* p = data.data();
+    const char* end = p + data.size();
+    binlog::Style style;
+    if (!binlog::readHeader(p, end, style)) {
+        std::cerr << path << ": not a calculator log\n";
+        return 1;
+    }
+    binlog::Record record;
+    int64_t previousMicros = 0;
+    while (p < end) {
+        size_t offset = p - data.data();
+        if (!binlog::decode(p, end, record, previousMicros)) {
+            std::cerr << path << ": corrupt or truncated record at byte " << offset << "\n";
+            return 1;
+        }
+        if (record.tag == binlog::Tag::Session) continue; // Only resets the clock
+        if (timestamps) std::cout << '[' << formatTime(record.micros) << "] ";
+        printRecord(std::cout, style, record, format);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    bool timestamps = false;
+    NumberFormat format;
+    int status = 0, files = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-t") {
+            timestamps = true;
+            continue;
+        }
+        if (format.parseOption(arg)) continue;
+        status |= decodeFile(arg, timestamps, format);
+        files++;
+    }
+    if (files == 0) {
+        std::cerr << "Usage: " << argv[0] << " [-t] [--precision=N | --shortest] <log file>...\n";
+        return 2;
+    }
+    return status;
+}
@@ -0,0 +1,575 @@
+// Re-executes calculator logs and checks every result against the one recorded.
+// history_final logs (binary, or the old history_final.txt "Input:/Result:" pairs) replay through the
+// final_submission interpreter, calculation_log ones ("Expression: ... = ...") through kyapata's.
+//
+// Usage: log_replay [--threads=N] [--min-run=N] [--tolerance=X] [--snapshot=PATH] [--array=NAME=PATH]
+//                   [--precision=N | --shortest] <log file>...
+//        log_replay --bench
+// The log is streamed in chunks, so its size is not bounded by memory. Statements that assign run one at
+// a time, in log order; each run of assignment-free statements between two of them only reads state,
+// so it is spread over --threads workers (all cores by default). Runs shorter than --min-run stay on
+// the main engine, where they cost no copy of the variables.
+// Recorded numbers match when they are within --tolerance (relative, 1e-9 by default); results the log
+// only has as text must print the same, or be within --tolerance of a number printed in another format. --snapshot and --array set up the state a history log started
+// from (final_submission logs neither :load nor a restored snapshot). The exit status is 1 when any
+// entry differs.
+
+// Everything the engines include, pulled in here first so the includes inside the namespaces are no-ops
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <stack>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__unix__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "binary_log.h"
+#include "epoch.h"
+
+#define main engine_main
+namespace final_submission {
+#include "final_submission"
+}
+namespace kyapata {
+#include "kyapata.cpp"
+}
+#undef main
+
+using final_submission::MappedFile;
+using final_submission::WorkStealingPool;
+
+// One logged input and what it produced
+struct Entry {
+    enum class Expect : uint8_t {
+        Value,   // A number, recorded exactly (binary logs)
+        Printed, // A result the log only has as text
+        Nothing, // An assignment, which prints nothing
+        Error    // text holds the message
+    };
+    std::string input;
+    Expect expect = Expect::Nothing;
+    double value = 0;
+    std::string text;
+};
+
+// What re-executing an input produced
+struct Replayed {
+    bool failed = false;  // text holds the message
+    bool printed = false; // false after an assignment
+    bool numeric = false; // The result is value; otherwise it is text
+    double value = 0;
+    std::string text;
+};
+
+// Streams the entries of a binary log or of one of the text logs it replaced
+class LogReader {
+private:
+    MappedFile file;
+    const char* p = nullptr;
+    const char* end = nullptr;
+    const char* start = nullptr;
+    bool binary = false;
+    binlog::Style logStyle = binlog::Style::History;
+    int64_t previousMicros = 0;
+    std::string problem;
+
+    std::string_view line() {
+        const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        const char* stop = newline ? newline : end;
+        std::string_view text(p, stop - p);
+        p = newline ? newline + 1 : end;
+        if (!text.empty() && text.back() == '\r') text.remove_suffix(1);
+        return text;
+    }
+
+    bool fail(const std::string& what, const char* at) {
+        problem = what + " at byte " + std::to_string(at - start);
+        return false;
+    }
+
+    static bool startsWith(std::string_view text, std::string_view prefix) { return text.substr(0, prefix.size()) == prefix; }
+
+    // "# N records dropped", written by log_decoder where a Drop-policy log lost records
+    static bool droppedLine(std::string_view text, uint64_t& dropped) {
+        if (!startsWith(text, "# ")) return false;
+        uint64_t count = 0;
+        auto parsed = std::from_chars(text.data() + 2, text.data() + text.size(), count);
+        if (parsed.ec != std::errc() || std::string_view(parsed.ptr, text.data() + text.size() - parsed.ptr) != " records dropped") return false;
+        dropped += count;
+        return true;
+    }
+
+    bool nextBinary(Entry& entry, uint64_t& dropped) {
+        binlog::Record record;
+        while (p < end) {
+            const char* at = p;
+            if (!binlog::decode(p, end, record, previousMicros)) return fail("corrupt or truncated record", at);
+            if (record.tag == binlog::Tag::Dropped) {
+                dropped += record.count;
+                continue;
+            }
+            if (record.tag == binlog::Tag::Session) continue;
+            entry.input = std::move(record.input);
+            entry.text = std::move(record.text);
+            entry.value = record.value;
+            entry.expect = record.tag == binlog::Tag::Value ? Entry::Expect::Value
+                         : record.tag == binlog::Tag::Error ? Entry::Expect::Error
+                         : record.tag == binlog::Tag::Text ? Entry::Expect::Printed
+                         : Entry::Expect::Nothing;
+            return true;
+        }
+        return false;
+    }
+
+    // Input: <input>
+    // Result: <result, "Error: <message>", or nothing after an assignment>
+    bool nextHistory(Entry& entry, uint64_t& dropped) {
+        while (p < end) {
+            const char* at = p;
+            std::string_view input = line();
+            if (input.empty() || droppedLine(input, dropped)) continue;
+            if (!startsWith(input, "Input: ")) return fail("expected \"Input: \"", at);
+            at = p;
+            std::string_view result = p < end ? line() : std::string_view();
+            if (!startsWith(result, "Result:")) return fail("expected \"Result:\"", at);
+            result.remove_prefix(result.size() > 7 && result[7] == ' ' ? 8 : 7);
+            entry.input.assign(input.substr(7));
+            entry.expect = result.empty() ? Entry::Expect::Nothing
+                         : startsWith(result, "Error: ") ? Entry::Expect::Error
+                         : Entry::Expect::Printed;
+            entry.text.assign(entry.expect == Entry::Expect::Error ? result.substr(7) : result);
+            return true;
+        }
+        return false;
+    }
+
+    // Expression: <input> = <value>   or   Expression: <input> | Error: <message>
+    bool nextCalculation(Entry& entry, uint64_t& dropped) {
+        while (p < end) {
+            const char* at = p;
+            std::string_view text = line();
+            if (text.empty() || droppedLine(text, dropped)) continue;
+            if (!startsWith(text, "Expression: ")) return fail("expected \"Expression: \"", at);
+            text.remove_prefix(12);
+            size_t split = text.find(" | Error: ");
+            if (split != std::string_view::npos) {
+                entry.expect = Entry::Expect::Error;
+                entry.text.assign(text.substr(split + 10));
+            } else {
+                split = text.rfind(" = "); // The input may be an assignment itself
+                if (split == std::string_view::npos) return fail("no result", at);
+                entry.expect = Entry::Expect::Printed;
+                entry.text.assign(text.substr(split + 3));
+            }
+            entry.input.assign(text.substr(0, split));
+            return true;
+        }
+        return false;
+    }
+
+public:
+    explicit LogReader(const std::string& path) : file(path) {
+        if (!file.isOpen()) {
+            problem = "cannot open";
+            return;
+        }
+        std::string_view text = file.text();
+        start = p = text.data();
+        end = p + text.size();
+        if (binlog::readHeader(p, end, logStyle)) {
+            binary = true;
+            return;
+        }
+        const char* first = p;
+        while (first < end && std::isspace(uint8_t(*first))) first++;
+        std::string_view head(first, end - first);
+        if (startsWith(head, "Input: ")) logStyle = binlog::Style::History;
+        else if (startsWith(head, "Expression: ")) logStyle = binlog::Style::Calculation;
+        else if (!head.empty()) problem = "not a calculator log";
+    }
+
+    binlog::Style style() const { return logStyle; }
+    const std::string& error() const { return problem; } // Why the log could not be read, empty if it could
+
+    // Reads the next entry, adding records the log says were lost to dropped. False at the end of the
+    // log, or when the rest cannot be read (error() then says why).
+    bool next(Entry& entry, uint64_t& dropped) {
+        if (!problem.empty()) return false;
+        if (binary) return nextBinary(entry, dropped);
+        return logStyle == binlog::Style::History ? nextHistory(entry, dropped) : nextCalculation(entry, dropped);
+    }
+};
+
+// final_submission: assignments run on the main interpreter, which keeps formulas and recomputes
+// their dependents; workers evaluate on batch-mode mirrors of its variables
+class HistoryEngine {
+private:
+    final_submission::Context context;
+    final_submission::Interpreter interpreter{&context};
+    std::vector<std::unique_ptr<final_submission::BatchWorker>> workers;
+    std::vector<uint32_t> changed; // Slots the main interpreter has written, which workers copy
+    std::vector<final_submission::Token> tokens;
+    std::string scratch;
+
+    static void capture(final_submission::Interpreter& interpreter, std::string_view input, Replayed& out) {
+        using Outcome = final_submission::Interpreter::Outcome;
+        out.text.clear();
+        Outcome outcome = interpreter.interpret(input, out.text, out.value);
+        out.failed = outcome == Outcome::Error;
+        out.printed = outcome == Outcome::Value || outcome == Outcome::Array;
+        out.numeric = outcome == Outcome::Value;
+        if (out.failed) out.text.erase(0, 7); // "Error: "
+    }
+
+public:
+    // format: how the REPL that wrote the log printed arrays
+    HistoryEngine(size_t threads, final_submission::NumberFormat format) {
+        interpreter.format = format;
+        interpreter.dependencies().changeLog = &changed;
+        for (size_t i = 0; i < threads; i++) {
+            workers.push_back(std::make_unique<final_submission::BatchWorker>());
+            workers.back()->interpreter.format = format;
+        }
+    }
+
+    bool start(const final_submission::StartupState& state, std::string& message) { return state.apply(context, interpreter, message); }
+
+    bool assigns(std::string_view input) {
+        return input.find('=') != std::string_view::npos && final_submission::ExpressionCompiler::assigns(input, tokens);
+    }
+
+    void run(std::string_view input, Replayed& out) { capture(interpreter, input, out); }
+
+    // On worker, which first copies the variables the main interpreter changed since its last run
+    void run(size_t worker, uint64_t, std::string_view input, Replayed& out) {
+        final_submission::BatchWorker& w = *workers[worker];
+        w.sync(context, changed);
+        capture(w.interpreter, input, out);
+    }
+
+    // The way the REPL printed results into history_final.txt (log_decoder prints the exact value by default)
+    std::string print(double value) {
+        scratch.clear();
+        final_submission::appendNumber(scratch, value, final_submission::NumberFormat());
+        return scratch;
+    }
+};
+
+// kyapata: plain variables, no formulas; a worker copies the variable map when it falls behind
+class CalculationEngine {
+private:
+    struct Worker {
+        kyapata::Context context;
+        kyapata::Interpreter interpreter{&context};
+        uint64_t version = UINT64_MAX;
+    };
+    kyapata::Context context;
+    kyapata::Interpreter interpreter{&context};
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    static void capture(kyapata::Interpreter& interpreter, std::string_view input, Replayed& out) {
+        out.printed = true;
+        out.numeric = true;
+        try {
+            out.value = interpreter.interpret(input);
+            out.failed = false;
+        } catch (const std::exception& e) {
+            out.failed = true;
+            out.text = e.what();
+        }
+    }
+
+public:
+    explicit CalculationEngine(size_t threads) {
+        for (size_t i = 0; i < threads; i++) workers.push_back(std::make_unique<Worker>());
+    }
+
+    static bool assigns(std::string_view input) { return input.find('=') != std::string_view::npos; }
+
+    void run(std::string_view input, Replayed& out) { capture(interpreter, input, out); }
+
+    void run(size_t worker, uint64_t version, std::string_view input, Replayed& out) {
+        Worker& w = *workers[worker];
+        if (w.version != version) {
+            w.context.variables = context.variables;
+            w.version = version;
+        }
+        capture(w.interpreter, input, out);
+    }
+
+    // The way kyapata printed results into calculation_log.txt
+    static std::string print(double value) {
+        std::ostringstream stream;
+        stream << value;
+        return stream.str();
+    }
+};
+
+struct ReplayOptions {
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t minRun = 64;       // Shorter assignment-free runs are not worth copying the variables for
+    double tolerance = 1e-9;  // Relative, and absolute for numbers below 1
+    size_t chunk = 1 << 16;   // Entries read and replayed at a time
+    size_t maxReported = 20;  // Mismatches printed per log
+};
+
+struct ReplayStats {
+    uint64_t entries = 0, assignments = 0, parallelRuns = 0, parallelEntries = 0, mismatches = 0, dropped = 0;
+};
+
+// Replays entries in log order. Version counts the assignments so far: a worker whose copy of the
+// variables was made at an older version refreshes it before evaluating.
+template <typename Engine>
+void replayChunk(const std::vector<Entry>& entries, std::vector<Replayed>& results, Engine& engine, WorkStealingPool& pool,
+                 const ReplayOptions& options, uint64_t& version, ReplayStats& stats) {
+    results.resize(entries.size());
+    size_t i = 0;
+    while (i < entries.size()) {
+        if (engine.assigns(entries[i].input)) {
+            engine.run(entries[i].input, results[i]);
+            stats.assignments++;
+            version++;
+            i++;
+            continue;
+        }
+        size_t end = i;
+        while (end < entries.size() && !engine.assigns(entries[end].input)) end++;
+        if (end - i < options.minRun || pool.size() == 1) {
+            for (; i < end; i++) engine.run(entries[i].input, results[i]);
+            continue;
+        }
+        pool.parallelFor(end - i, 64, [&, i](size_t worker, size_t k) { engine.run(worker, version, entries[i + k].input, results[i + k]); });
+        stats.parallelRuns++;
+        stats.parallelEntries += end - i;
+        i = end;
+    }
+}
+
+bool close(double recorded, double replayed, double tolerance) {
+    if (recorded == replayed || (std::isnan(recorded) && std::isnan(replayed))) return true;
+    double difference = std::fabs(recorded - replayed);
+    return difference <= tolerance * std::max({1.0, std::fabs(recorded), std::fabs(replayed)});
+}
+
+// Whether text is a whole number within tolerance of replayed, for results printed in another format
+bool closeToText(const std::string& text, double replayed, double tolerance) {
+    double recorded;
+    auto parsed = std::from_chars(text.data(), text.data() + text.size(), recorded);
+    return parsed.ec == std::errc() && parsed.ptr == text.data() + text.size() && close(recorded, replayed, tolerance);
+}
+
+template <typename Engine>
+bool matches(const Entry& entry, const Replayed& replayed, Engine& engine, double tolerance) {
+    switch (entry.expect) {
+        case Entry::Expect::Nothing: return !replayed.failed && !replayed.printed;
+        case Entry::Expect::Error: return replayed.failed && replayed.text == entry.text;
+        case Entry::Expect::Value: return !replayed.failed && replayed.numeric && close(entry.value, replayed.value, tolerance);
+        case Entry::Expect::Printed:
+            if (replayed.failed || !replayed.printed) return false;
+            if (!replayed.numeric) return replayed.text == entry.text;
+            return engine.print(replayed.value) == entry.text || closeToText(entry.text, replayed.value, tolerance);
+    }
+    return false;
+}
+
+// Full precision, so a mismatch within the printed digits still shows
+std::string exact(double value) {
+    char buffer[64];
+    auto written = std::to_chars(buffer, buffer + sizeof buffer, value);
+    return std::string(buffer, written.ptr);
+}
+
+std::string describe(const Entry& entry) {
+    switch (entry.expect) {
+        case Entry::Expect::Nothing: return "no result";
+        case Entry::Expect::Error: return "Error: " + entry.text;
+        case Entry::Expect::Value: return exact(entry.value);
+        case Entry::Expect::Printed: return entry.text;
+    }
+    return "";
+}
+
+std::string describe(const Replayed& replayed) {
+    if (replayed.failed) return "Error: " + replayed.text;
+    if (!replayed.printed) return "no result";
+    return replayed.numeric ? exact(replayed.value) : replayed.text;
+}
+
+template <typename Engine>
+int replayLog(const std::string& path, LogReader& reader, Engine& engine, const ReplayOptions& options) {
+    WorkStealingPool pool(options.threads);
+    std::vector<Entry> entries;
+    std::vector<Replayed> results;
+    ReplayStats stats;
+    uint64_t version = 0;
+    auto started = std::chrono::steady_clock::now();
+    bool more = true;
+    while (more) {
+        entries.resize(options.chunk);
+        size_t count = 0;
+        while (count < options.chunk && (more = reader.next(entries[count], stats.dropped))) count++;
+        entries.resize(count);
+        replayChunk(entries, results, engine, pool, options, version, stats);
+        for (size_t k = 0; k < count; k++) {
+            if (matches(entries[k], results[k], engine, options.tolerance)) continue;
+            if (++stats.mismatches <= options.maxReported) {
+                std::cout << path << ":" << stats.entries + k + 1 << ": " << entries[k].input << "\n"
+                          << "  recorded " << describe(entries[k]) << "\n"
+                          << "  replayed " << describe(results[k]);
+                if (entries[k].expect == Entry::Expect::Printed && results[k].numeric && !results[k].failed) {
+                    std::cout << " (prints " << engine.print(results[k].value) << ")";
+                }
+                std::cout << "\n";
+            }
+        }
+        stats.entries += count;
+    }
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    if (!reader.error().empty()) std::cerr << path << ": " << reader.error() << ", replay stopped there\n";
+    if (stats.mismatches > options.maxReported) std::cout << path << ": " << stats.mismatches - options.maxReported << " more mismatches not shown\n";
+    if (stats.dropped) std::cout << path << ": the log lost " << stats.dropped << " records, later entries may differ because of them\n";
+    std::cout << path << ": " << stats.entries << " entries, " << stats.mismatches << " mismatches, replayed in " << elapsed << " ms ("
+              << stats.assignments << " assignments in order, " << stats.parallelEntries << " entries in " << stats.parallelRuns
+              << " parallel runs on " << pool.size() << " threads)\n";
+    return stats.mismatches || !reader.error().empty() ? 1 : 0;
+}
+
+int replayFile(const std::string& path, const ReplayOptions& options, const final_submission::StartupState& state,
+               final_submission::NumberFormat format) {
+    LogReader reader(path);
+    if (!reader.error().empty()) {
+        std::cerr << path << ": " << reader.error() << "\n";
+        return 1;
+    }
+    if (reader.style() == binlog::Style::Calculation) {
+        CalculationEngine engine(options.threads);
+        return replayLog(path, reader, engine, options);
+    }
+    HistoryEngine engine(options.threads, format);
+    std::string message;
+    if (!engine.start(state, message)) {
+        std::cerr << message << "\n";
+        return 1;
+    }
+    return replayLog(path, reader, engine, options);
+}
+
+// Writes a binary history log the way the REPL would (an assignment every 1000 lines, the rest reading
+// the variables), then times its replay on one thread and on all of them
+void runBenchmark() {
+    const size_t count = 400000, variables = 100;
+    const char* path = "bench_replay.bin";
+    {
+        final_submission::Context context;
+        final_submission::Interpreter interpreter(&context);
+        binlog::AsyncWriter log(path, binlog::Style::History);
+        std::string out;
+        double value;
+        for (size_t i = 0; i < count; i++) {
+            std::string input = i % 1000 == 0 ? "v" + std::to_string(i / 1000 % variables) + " = " + std::to_string(i) + " / 7"
+                                              : "v" + std::to_string(i % variables) + " * 3 + max(v" + std::to_string(i * 7 % variables) + ", 2) / 5";
+            out.clear();
+            switch (interpreter.interpret(input, out, value)) {
+                case final_submission::Interpreter::Outcome::Value: log.value(input, value); break;
+                case final_submission::Interpreter::Outcome::Error: log.error(input, std::string_view(out).substr(7)); break;
+                default: log.empty(input); break;
+            }
+        }
+    }
+    ReplayOptions options;
+    size_t all = options.threads;
+    for (size_t threads : {size_t(1), all}) {
+        options.threads = threads;
+        std::cout << "threads " << threads << ": ";
+        std::cout.flush();
+        replayFile(path, options, final_submission::StartupState(), final_submission::NumberFormat());
+        if (all == 1) break;
+    }
+    std::remove(path);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        runBenchmark();
+        return 0;
+    }
+    ReplayOptions options;
+    final_submission::StartupState state;
+    final_submission::NumberFormat format;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        char* end = nullptr;
+        if (arg.compare(0, 10, "--threads=") == 0) {
+            options.threads = std::max(1ul, std::strtoul(arg.c_str() + 10, &end, 10));
+        } else if (arg.compare(0, 10, "--min-run=") == 0) {
+            options.minRun = std::strtoul(arg.c_str() + 10, &end, 10);
+        } else if (arg.compare(0, 12, "--tolerance=") == 0) {
+            options.tolerance = std::strtod(arg.c_str() + 12, &end);
+        } else if (arg.compare(0, 11, "--snapshot=") == 0) {
+            state.snapshot = arg.substr(11);
+        } else if (arg.compare(0, 8, "--array=") == 0 && arg.find('=', 8) != std::string::npos) {
+            size_t equals = arg.find('=', 8);
+            std::string message;
+            final_submission::Array array = final_submission::loadArray(arg.substr(equals + 1), message);
+            if (!array) {
+                std::cerr << message << "\n";
+                return 2;
+            }
+            state.arrays.emplace_back(arg.substr(8, equals - 8), std::move(array));
+        } else if (final_submission::NumberFormat::parseOption(arg, format)) {
+            continue;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            std::cerr << "Unknown option " << arg << "\n";
+            return 2;
+        } else {
+            paths.push_back(arg);
+        }
+        if (end && *end) {
+            std::cerr << "Bad value in " << arg << "\n";
+            return 2;
+        }
+    }
+    if (paths.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--threads=N] [--min-run=N] [--tolerance=X] [--snapshot=PATH] [--array=NAME=PATH]"
+                  << " [--precision=N | --shortest] <log file>...\n";
+        return 2;
+    }
+    int status = 0;
+    for (const std::string& path : paths) status |= replayFile(path, options, state, format);
+    return status;
+}
@@ -9,6 +9,11 @@
 #include <sstream>
 #include <cmath>
 #include <stdexcept>
+#include <charconv>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include "fast_trig.h"
 
 // Context
 class Context {
@@ -24,6 +29,9 @@ private:
     std::ofstream logFile;
 
 public:
+    int precision = 2; // Digits after the decimal point in printed results
+    fasttrig::Mode trigMode = fasttrig::Mode::Libm; // How sin, cos and tan are computed, see fast_trig.h
+
     Interpreter(Context* context) : context(context), logFile("calculations.log", std::ios::app) {}
 
     std::string interpret(std::string input) {
@@ -38,16 +46,26 @@ public:
                 context->variables[var] = evaluateExpression(expr);
                 return "";
             }
-            std::ostringstream stream;
-            stream << std::fixed << std::setprecision(2) << evaluateExpression(input);
-            std::string result = stream.str();
-            logFile << input << " = " << result << std::endl;
+            char buffer[400]; // Room for fixed notation of any double
+            std::to_chars_result written = std::to_chars(buffer, buffer + sizeof buffer, evaluateExpression(input),
+                                                         std::chars_format::fixed, precision);
+            if (precision < 0 || written.ec != std::errc()) {
+                throw std::runtime_error("Cannot print a result with precision " + std::to_string(precision));
+            }
+            std::string result(buffer, written.ptr);
+            logFile << input << " = " << result << '\n';
             return result;
         } catch (const std::exception& e) {
             return std::string("Error: ") + e.what();
         }
     }
 
+    // Evaluates an expression and returns the number itself, without formatting or logging it
+    double evaluate(std::string input) {
+        trim(input);
+        return evaluateExpression(input);
+    }
+
 private:
     double evaluateExpression(const std::string& input) {
         if (context->variables.find(input) != context->variables.end()) {
@@ -107,13 +125,81 @@ private:
         }
         std::string arg = input.substr(start + 1, end - start - 1);
         double value = evaluateExpression(arg);
-        double radians = value * M_PI / 180.0; 
-        if (func == "sin") return std::sin(radians);
-        if (func == "cos") return std::cos(radians);
-        if (func == "tan") return std::tan(radians);
+        if (func == "sin") return fasttrig::evaluate(fasttrig::Function::Sin, trigMode, value);
+        if (func == "cos") return fasttrig::evaluate(fasttrig::Function::Cos, trigMode, value);
+        if (func == "tan") return fasttrig::evaluate(fasttrig::Function::Tan, trigMode, value);
         throw std::runtime_error("Unknown function: " + func);
     }
 
+    std::vector<std::string> tokenize(const std::string& input) {
+        std::vector<std::string> tokens;
+        std::string token;
+        bool lastWasOperator = true;
+        for (size_t i = 0; i < input.size(); i++) {
+            char c = input[i];
+            if (std::isdigit(c) || c == '.' || (c == '-' && lastWasOperator)) {
+                token += c;
+                lastWasOperator = false;
+            } else {
+                if (!token.empty()) {
+                    tokens.push_back(token);
+                    token.clear();
+                }
+                if (c != ' ') {
+                    tokens.push_back(std::string(1, c));
+                    lastWasOperator = true;
+                }
+            }
+        }
+        if (!token.empty()) {
+            tokens.push_back(token);
+        }
+        return tokens;
+    }
+
+    double evaluateMathExpression(const std::vector<std::string>& tokens) {
+        std::stack<double> values;
+        std::stack<char> operators;
+        for (const std::string& token : tokens) {
+            if (std::isdigit(token[0]) || token.find('.') != std::string::npos || (token[0] == '-' && token.size() > 1)) {
+                values.push(std::stod(token));
+            } else if (context->variables.find(token) != context->variables.end()) {
+                values.push(context->variables[token]);
+            } else if (token == "(") {
+                operators.push('(');
+            } else if (token == ")") {
+                while (!operators.empty() && operators.top() != '(') {
+                    applyOperator(values, operators);
+                }
+                operators.pop();
+            } else if (precedence.find(token[0]) != precedence.end()) {
+                while (!operators.empty() && operators.top() != '(' && precedence[operators.top()] >= precedence[token[0]]) {
+                    applyOperator(values, operators);
+                }
+                operators.push(token[0]);
+            } else {
+                throw std::runtime_error("Undefined variable or invalid input: " + token);
+            }
+        }
+        while (!operators.empty()) {
+            applyOperator(values, operators);
+        }
+        return values.top();
+    }
+
+    void applyOperator(std::stack<double>& values, std::stack<char>& operators) {
+        char op = operators.top(); operators.pop();
+        double right = values.top(); values.pop();
+        double left = values.top(); values.pop();
+        switch (op) {
+            case '+': values.push(left + right); break;
+            case '-': values.push(left - right); break;
+            case '*': values.push(left * right); break;
+            case '/': if (right == 0) throw std::runtime_error("Division by zero"); values.push(left / right); break;
+            case '%': if (right == 0) throw std::runtime_error("Modulo by zero"); values.push(std::fmod(left, right)); break;
+        }
+    }
+    
     void trim(std::string& str) {
         str.erase(0, str.find_first_not_of(" "));
         str.erase(str.find_last_not_of(" ") + 1);
@@ -131,9 +217,90 @@ private:
     }
 };
 
-int main() {
+// Error of a result in units in the last place of the exact value
+double ulpError(double result, long double exact) {
+    if (std::isinf(result) && std::isinf(double(exact))) return 0;
+    if (exact == 0) return result == 0 ? 0 : INFINITY;
+    int exponent;
+    std::frexp(double(exact), &exponent);
+    return double(std::fabs(result - exact) / std::ldexp(1.0L, exponent - 53));
+}
+
+// sin, cos or tan of an angle in degrees in long double, reduced exactly like fast_trig.h does
+long double exactTrig(fasttrig::Function function, double degrees) {
+    long double turn = std::fmod((long double)degrees, 360.0L);
+    long double quadrant = std::nearbyint(turn / 90);
+    long double radians = (turn - quadrant * 90) * (3.141592653589793238462643383279502884L / 180);
+    long double s = std::sin(radians), c = std::cos(radians);
+    switch ((long long)quadrant & 3) {
+        case 1: std::swap(s, c); c = -c; break;
+        case 2: s = -s; c = -c; break;
+        case 3: std::swap(s, c); s = -s; break;
+    }
+    return function == fasttrig::Function::Sin ? s : function == fasttrig::Function::Cos ? c : s / c;
+}
+
+// Throughput and max ulp error of each mode on random angles, with libm as the baseline
+void runBenchmark() {
+    const size_t count = 1 << 16;
+    const int rounds = 100;
+    std::vector<double> angles(count), results(count);
+    std::mt19937_64 random(42);
+    std::uniform_real_distribution<double> angle(-1e6, 1e6);
+    for (double& a : angles) a = angle(random);
+
+    const char* functions[] = {"sin", "cos", "tan"};
+    const char* modes[] = {"libm", "poly", "table"};
+    std::cout << std::left << std::setw(6) << "func" << std::setw(8) << "mode" << std::right << std::setw(12) << "ns/angle"
+              << std::setw(10) << "speedup" << std::setw(14) << "max ulp" << '\n';
+    for (int f = 0; f < 3; f++) {
+        double baseline = 0;
+        for (int m = 0; m < 3; m++) {
+            auto function = fasttrig::Function(f);
+            auto mode = fasttrig::Mode(m);
+            auto start = std::chrono::steady_clock::now();
+            for (int round = 0; round < rounds; round++) fasttrig::evaluate(function, mode, angles.data(), results.data(), count);
+            double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (double(rounds) * count);
+            if (m == 0) baseline = nanos;
+            double worst = 0;
+            for (size_t i = 0; i < count; i++) worst = std::max(worst, ulpError(results[i], exactTrig(function, angles[i])));
+            std::cout << std::left << std::setw(6) << functions[f] << std::setw(8) << modes[m] << std::right << std::fixed
+                      << std::setprecision(2) << std::setw(12) << nanos << std::setw(9) << baseline / nanos << 'x'
+                      << std::setprecision(1) << std::setw(14) << worst << '\n';
+        }
+    }
+
+    // Infinities and NaN must come back as NaN in every mode, one at a time and inside an array
+    std::vector<double> special{0, INFINITY, 1, -INFINITY, NAN, 90};
+    std::vector<double> out(special.size());
+    bool nan = true;
+    for (int f = 0; f < 3; f++) {
+        for (int m = 0; m < 3; m++) {
+            auto function = fasttrig::Function(f);
+            auto mode = fasttrig::Mode(m);
+            fasttrig::evaluate(function, mode, special.data(), out.data(), special.size());
+            for (size_t i = 1; i < special.size(); i++) {
+                if (!std::isfinite(special[i])) nan = nan && std::isnan(out[i]) && std::isnan(fasttrig::evaluate(function, mode, special[i]));
+            }
+        }
+    }
+    std::cout << "inf and NaN angles: " << (nan ? "NaN in every mode" : "FAILED") << '\n';
+}
+
+int main(int argc, char* argv[]) {
     Context context;
     Interpreter interpreter(&context);
+    for (int i = 1; i < argc; i++) {
+        if (std::strncmp(argv[i], "--trig=", 7) == 0) {
+            if (!fasttrig::parseMode(argv[i] + 7, interpreter.trigMode)) {
+                std::cerr << "Unknown trig mode: " << argv[i] + 7 << " (expected libm, poly or table)" << std::endl;
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--bench") == 0) {
+            runBenchmark();
+            return 0;
+        }
+    }
     std::string input;
     while (true) {
         std::cout << "Enter expression: ";